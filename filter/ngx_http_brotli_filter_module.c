@@ -14,12 +14,283 @@
 #include <brotli/encode.h>
 #endif
 
+/* Static tracepoints of "ngx_brotli" provider; see README for arguments. */
+#if (NGX_HTTP_BROTLI_USDT)
+#include <sys/sdt.h>
+#define ngx_http_brotli_probe2(name, a1, a2)                          \
+  DTRACE_PROBE2(ngx_brotli, name, a1, a2)
+#define ngx_http_brotli_probe3(name, a1, a2, a3)                      \
+  DTRACE_PROBE3(ngx_brotli, name, a1, a2, a3)
+#define ngx_http_brotli_probe4(name, a1, a2, a3, a4)                  \
+  DTRACE_PROBE4(ngx_brotli, name, a1, a2, a3, a4)
+#define ngx_http_brotli_probe5(name, a1, a2, a3, a4, a5)              \
+  DTRACE_PROBE5(ngx_brotli, name, a1, a2, a3, a4, a5)
+#else
+#define ngx_http_brotli_probe2(name, a1, a2)
+#define ngx_http_brotli_probe3(name, a1, a2, a3)
+#define ngx_http_brotli_probe4(name, a1, a2, a3, a4)
+#define ngx_http_brotli_probe5(name, a1, a2, a3, a4, a5)
+#endif
+
 /* Brotli and GZip modules never stack, i.e. when one of them sets
    "Content-Encoding" the other becomes a pass-through filter. Consequently,
    it is almost legal to reuse this "buffered" bit.
    IIUC, buffered == some data passed to filter has not been pushed further. */
 #define NGX_HTTP_BROTLI_BUFFERED NGX_HTTP_GZIP_BUFFERED
 
+/* Each encoder allocation is prefixed with its size, so that the amount of
+   memory held by the encoder could be tracked on free. Two words keep the
+   payload aligned the same way as the pool allocator aligns it. */
+#define NGX_HTTP_BROTLI_ALLOC_HEADER_SIZE (2 * sizeof(size_t))
+
+/* Location of a configuration without statistics node. */
+#define NGX_HTTP_BROTLI_STATS_NONE NGX_CONF_UNSET_UINT
+
+/* Static module reports its lookups via "$brotli_static" variable. */
+static ngx_str_t ngx_http_brotli_static_var = ngx_string("brotli_static");
+static ngx_str_t ngx_http_brotli_static_module_name =
+    ngx_string("ngx_http_brotli_static_module");
+
+/* Reasons of response not being compressed, see ngx_http_brotli_skip_reasons. */
+#define NGX_HTTP_BROTLI_SKIP_NONE 0
+#define NGX_HTTP_BROTLI_SKIP_DISABLED 1
+#define NGX_HTTP_BROTLI_SKIP_SUBREQUEST 2
+#define NGX_HTTP_BROTLI_SKIP_STATUS 3
+#define NGX_HTTP_BROTLI_SKIP_HEADER_ONLY 4
+#define NGX_HTTP_BROTLI_SKIP_ENCODED 5
+#define NGX_HTTP_BROTLI_SKIP_MIN_LENGTH 6
+#define NGX_HTTP_BROTLI_SKIP_TYPE 7
+#define NGX_HTTP_BROTLI_SKIP_ACCEPT_ENCODING 8
+#define NGX_HTTP_BROTLI_SKIP_N 9
+
+static ngx_str_t ngx_http_brotli_skip_reasons[] = {
+    ngx_null_string,          ngx_string("disabled"),
+    ngx_string("subrequest"), ngx_string("status"),
+    ngx_string("header_only"), ngx_string("encoded"),
+    ngx_string("min_length"), ngx_string("type"),
+    ngx_string("accept_encoding")};
+
+/* Statistics counters; updated atomically by all workers. */
+typedef struct {
+  /* Responses compressed on-the-fly. */
+  ngx_atomic_t compressed;
+  /* Responses in enabled locations passed through uncompressed. */
+  ngx_atomic_t skipped;
+  ngx_atomic_t bytes_in;
+  ngx_atomic_t bytes_out;
+  ngx_atomic_t encoder_usec;
+  /* Pre-compressed files served / looked up in vain by static module. */
+  ngx_atomic_t static_hits;
+  ngx_atomic_t static_misses;
+  /* Compression streams that failed. */
+  ngx_atomic_t errors;
+  /* Responses passed through uncompressed and their body bytes, by reason;
+     unlike "skipped", these include locations where compression is disabled. */
+  ngx_atomic_t skip_responses[NGX_HTTP_BROTLI_SKIP_N];
+  ngx_atomic_t skip_bytes[NGX_HTTP_BROTLI_SKIP_N];
+} ngx_http_brotli_stats_counters_t;
+
+/* Statistics node of a server or location; lives in shared memory and
+   survives reloads, as long as zone is not resized. */
+typedef struct ngx_http_brotli_stats_node_s ngx_http_brotli_stats_node_t;
+struct ngx_http_brotli_stats_node_s {
+  ngx_http_brotli_stats_node_t* next;
+  ngx_http_brotli_stats_counters_t counters;
+  size_t len;
+  u_char key[1];
+};
+
+/* Log-bucketed histogram: values below 4 get own buckets, then every power of
+   two is split into 4 buckets; the last one also collects values above 2^32. */
+#define NGX_HTTP_BROTLI_HIST_BUCKETS 124
+
+/* MIME types are truncated to this length in histogram keys. */
+#define NGX_HTTP_BROTLI_HIST_TYPE_LEN 64
+
+/* Histogram nodes cached per location in every worker. */
+#define NGX_HTTP_BROTLI_HIST_CACHE 8
+
+typedef struct {
+  ngx_atomic_t count;
+  ngx_atomic_t sum;
+  ngx_atomic_t buckets[NGX_HTTP_BROTLI_HIST_BUCKETS];
+} ngx_http_brotli_hist_t;
+
+/* Histograms of a location (or server) and MIME type. Nodes are never freed,
+   and are published in "hist" list, which is walked without locking. */
+typedef struct ngx_http_brotli_hist_node_s ngx_http_brotli_hist_node_t;
+struct ngx_http_brotli_hist_node_s {
+  ngx_rbtree_node_t node;
+  ngx_http_brotli_hist_node_t* next;
+
+  /* Encoder CPU time, microseconds. */
+  ngx_http_brotli_hist_t encoder_time;
+  /* Time from response header to first compressed byte, microseconds. */
+  ngx_http_brotli_hist_t first_byte;
+  /* Compressed size, bytes. */
+  ngx_http_brotli_hist_t size;
+  /* Compression ratio, hundredths. */
+  ngx_http_brotli_hist_t ratio;
+
+  /* Statistics node key, see ngx_http_brotli_stats_key_t, then MIME type. */
+  size_t key_len;
+  size_t type_len;
+  u_char data[1];
+};
+
+/* Encoder memory accounting of a worker, or of (quality, window) pair. */
+typedef struct {
+  /* Bytes currently allocated by encoders, and the peak of that value. */
+  ngx_atomic_t live;
+  ngx_atomic_t peak;
+  /* Largest peak of a single encoder. */
+  ngx_atomic_t stream_peak;
+  /* Encoders currently alive, and encoders created. */
+  ngx_atomic_t encoders;
+  ngx_atomic_t streams;
+} ngx_http_brotli_memory_t;
+
+/* Accounting of a worker process. */
+typedef struct {
+  ngx_http_brotli_memory_t memory;
+
+  /* Time event loop was blocked in encoder, microseconds: total, longest
+     single body filter call, and the most within a second. */
+  ngx_atomic_t block_usec;
+  ngx_atomic_t block_max_usec;
+  ngx_atomic_t block_second_max_usec;
+  /* Body filter calls that invoked encoder, and ones over "brotli_block_warn". */
+  ngx_atomic_t blocks;
+  ngx_atomic_t slow_blocks;
+
+  /* Input bytes queued in body filters of live streams, and bytes used in
+     request pools of those streams; see ngx_http_brotli_pool_bytes(). */
+  ngx_atomic_t queued_input;
+  ngx_atomic_t pool;
+} ngx_http_brotli_worker_t;
+
+/* Tenant keys are truncated to this length. */
+#define NGX_HTTP_BROTLI_TENANT_LEN 128
+
+/* Encoder CPU accounting of a tenant, see "brotli_tenant". Nodes are never
+   freed, and are published in "tenants" list, which is walked without
+   locking. */
+typedef struct ngx_http_brotli_tenant_s ngx_http_brotli_tenant_t;
+struct ngx_http_brotli_tenant_s {
+  ngx_str_node_t sn;
+  ngx_http_brotli_tenant_t* next;
+
+  /* Encoder CPU time, microseconds: total, and within quota window that
+     started at "window_start" (seconds). */
+  ngx_atomic_t usec;
+  ngx_atomic_t window_usec;
+  ngx_atomic_t window_start;
+  /* Encoders created, ones created while over quota, and ones that were
+     degraded to lower quality because of that. */
+  ngx_atomic_t streams;
+  ngx_atomic_t over_quota;
+  ngx_atomic_t degraded;
+
+  u_char data[1];
+};
+
+#define NGX_HTTP_BROTLI_WINDOWS \
+  (BROTLI_MAX_WINDOW_BITS - BROTLI_MIN_WINDOW_BITS + 1)
+
+/* Shared part of statistics zone. */
+typedef struct {
+  ngx_http_brotli_stats_node_t* nodes;
+
+  /* Per worker process accounting, indexed by ngx_worker. */
+  ngx_http_brotli_worker_t* workers;
+  ngx_uint_t nworkers;
+  /* Encoder memory per quality and window bits. */
+  ngx_http_brotli_memory_t encoders[BROTLI_MAX_QUALITY + 1]
+                                   [NGX_HTTP_BROTLI_WINDOWS];
+
+  ngx_rbtree_t hist_rbtree;
+  ngx_rbtree_node_t hist_sentinel;
+  ngx_http_brotli_hist_node_t* hist;
+
+  ngx_rbtree_t tenant_rbtree;
+  ngx_rbtree_node_t tenant_sentinel;
+  ngx_http_brotli_tenant_t* tenants;
+} ngx_http_brotli_stats_sh_t;
+
+/* Description of statistics node; names are JSON-escaped, labels are escaped
+   for Prometheus. */
+typedef struct {
+  ngx_str_t key;
+  ngx_str_t server;
+  ngx_str_t location;
+  ngx_str_t server_label;
+  ngx_str_t location_label;
+  unsigned is_location : 1;
+} ngx_http_brotli_stats_key_t;
+
+/* Escapes names for a report format, same as ngx_escape_json(). */
+typedef uintptr_t (*ngx_http_brotli_escape_pt)(u_char* dst, u_char* src,
+                                               size_t size);
+
+/* Sampled log of compression events, one JSON object per line; buffered
+   per worker. */
+typedef struct {
+  ngx_open_file_t* file;
+
+  u_char* start;
+  u_char* pos;
+  u_char* last;
+
+  /* Flushes non-empty buffer at most "flush" after it was written to. */
+  ngx_event_t* event;
+  ngx_msec_t flush;
+
+  /* Each response is logged with probability 1/sample. */
+  ngx_uint_t sample;
+
+  /* Quality each flushed buffer is compressed with, as a complete stream
+     into "out"; -1, if written as is. */
+  ngx_int_t quality;
+  u_char* out;
+  size_t out_size;
+} ngx_http_brotli_event_log_t;
+
+/* Main configuration. */
+typedef struct {
+  /* Statistics zone; NULL, if not configured. */
+  ngx_shm_zone_t* stats_zone;
+  ngx_slab_pool_t* stats_shpool;
+  ngx_http_brotli_stats_sh_t* stats_sh;
+
+  /* Servers and locations accounted in zone, see ngx_http_brotli_stats_key_t;
+     stats_nodes holds corresponding nodes, once zone is initialized. */
+  ngx_array_t stats_keys;
+  ngx_http_brotli_stats_node_t** stats_nodes;
+
+  /* 1 if "brotli_status" is used in some location. */
+  ngx_flag_t status;
+
+  /* Index of "$brotli_static" variable; NGX_ERROR if static module is absent. */
+  ngx_int_t static_index;
+
+  /* Number of workers is known only when zone is initialized. */
+  ngx_core_conf_t* ccf;
+
+  /* NULL, if "brotli_event_log" is off. */
+  ngx_http_brotli_event_log_t* event_log;
+
+  /* 1 if encoder time is reported in every location: by statistics zone,
+     event log, or indexed time variables. */
+  ngx_flag_t timing;
+} ngx_http_brotli_main_conf_t;
+
+/* Quality of responses with length in [min, max). */
+typedef struct {
+  off_t min;
+  off_t max;
+  ngx_int_t quality;
+} ngx_http_brotli_size_level_t;
+
 /* Module configuration. */
 typedef struct {
   ngx_flag_t enable;
@@ -35,12 +306,50 @@ typedef struct {
 
   /* Brotli encoder parameter: quality */
   ngx_int_t quality;
+  /* Quality evaluated per request; NULL, if "quality" is used as is. Empty
+     or invalid value leaves "quality". */
+  ngx_http_complex_value_t* quality_value;
 
   /* Brotli encoder parameter: (max) lg_win */
   size_t lg_win;
+  /* Window size evaluated per request; NULL, if "lg_win" is used as is.
+     Empty or invalid value leaves "lg_win". */
+  ngx_http_complex_value_t* lg_win_value;
+
+  /* Array of ngx_http_brotli_size_level_t that replace "quality" for
+     responses of known length, and quality of responses of unknown length;
+     NULL and -1 mean "quality". */
+  ngx_array_t* size_levels;
+  ngx_int_t size_unknown_level;
+
+  /* Bytes of response of unknown length that are held before encoder is
+     configured; 0 - none. */
+  size_t lookahead;
+
+  /* Indices of server and location statistics nodes in
+     ngx_http_brotli_main_conf_t.stats_keys; NGX_HTTP_BROTLI_STATS_NONE, if
+     not accounted. */
+  ngx_uint_t stats_server;
+  ngx_uint_t stats_location;
+  /* Histogram nodes of the statistics node by MIME type, direct-mapped by
+     hash; worker's copy of configuration is written, so that zone is locked
+     only when MIME type is seen first. */
+  ngx_http_brotli_hist_node_t* hist_cache[NGX_HTTP_BROTLI_HIST_CACHE];
+
+  /* Body filter call blocking event loop for longer is logged; 0 - never. */
+  ngx_msec_t block_warn;
+
+  /* Key of encoder CPU accounting; NULL, if not accounted per tenant. */
+  ngx_http_complex_value_t* tenant;
+  /* Encoder CPU time a tenant may use per "tenant_window" seconds; 0 - no
+     quota. Over quota, quality is lowered to "tenant_degrade"; -1 - kept. */
+  ngx_msec_t tenant_quota;
+  time_t tenant_window;
+  ngx_int_t tenant_degrade;
 } ngx_http_brotli_conf_t;
 
-/* Instance context. */
+/* Instance context. Responses that are not compressed get shared closed
+   context with skip_reason set, see ngx_http_brotli_skipped. */
 typedef struct {
   /* Brotli encoder instance. */
   BrotliEncoderState* encoder;
@@ -53,6 +362,44 @@ typedef struct {
   /* (compressed) bytes pulled from encoder. */
   size_t bytes_out;
 
+  /* Encoder parameters in effect; valid once stream is initialized. */
+  ngx_int_t quality;
+  size_t lg_win;
+
+  /* CPU time spent inside encoder, in microseconds. */
+  uint64_t encoder_usec;
+  /* Wall-clock time spent inside encoder in current body filter call, and
+     the longest such time, in microseconds. */
+  uint64_t block_usec;
+  uint64_t block_max_usec;
+  /* Number of flushes requested by the upstream. */
+  ngx_uint_t flushes;
+  /* Number of times output was stuck in the next filter. */
+  ngx_uint_t stalls;
+
+  /* Monotonic time of response header and of first compressed output,
+     in microseconds; 0, if not yet happened. */
+  uint64_t start_usec;
+  uint64_t first_byte_usec;
+
+  /* Bytes currently allocated by encoder, and the peak of that value. */
+  size_t memory;
+  size_t peak_memory;
+  /* Shared accounting of worker and of (quality, window) pair; NULL, if
+     there is no statistics zone, or encoder is not yet configured. */
+  ngx_http_brotli_memory_t* worker_memory;
+  ngx_http_brotli_memory_t* encoder_memory;
+  /* Shared accounting of worker; NULL, if there is no statistics zone. */
+  ngx_http_brotli_worker_t* worker;
+  /* Shares of this stream in "queued_input" and "pool" of worker. */
+  size_t queued_input;
+  size_t pool_bytes;
+  /* Shared accounting of tenant; NULL, if not accounted. */
+  ngx_http_brotli_tenant_t* tenant;
+
+  /* Head of response of unknown length; NULL, if no lookahead. */
+  ngx_buf_t* lookahead;
+
   /* Input buffer chain. */
   ngx_chain_t* in;
 
@@ -80,7 +427,19 @@ typedef struct {
   unsigned end_of_input : 1;
   unsigned end_of_block : 1;
 
+  /* 1 if encoder calls are timed, i.e. time is reported or limited. */
+  unsigned timed : 1;
+
+  /* 1 if lookahead is over, and its buffer is passed to encoder. */
+  unsigned lookahead_done : 1;
+
+  /* NGX_HTTP_BROTLI_SKIP_*, if response is not compressed. */
+  unsigned skip_reason : 4;
+
   ngx_http_request_t* request;
+  /* Pool encoder allocates from; r->pool is already NULL when request pool
+     cleanups run. */
+  ngx_pool_t* pool;
 } ngx_http_brotli_ctx_t;
 
 /* Forward declarations. */
@@ -92,9 +451,47 @@ static ngx_int_t ngx_http_brotli_filter_ensure_stream_initialized(
     ngx_http_request_t* r, ngx_http_brotli_ctx_t* ctx);
 /* Marks instance as closed and performs cleanup. */
 static void ngx_http_brotli_filter_close(ngx_http_brotli_ctx_t* ctx);
+/* Compresses input and passes output on; the body filter proper. */
+static ngx_int_t ngx_http_brotli_body_filter_process(ngx_http_request_t* r,
+                                                     ngx_http_brotli_ctx_t* ctx,
+                                                     ngx_chain_t* in);
+static ngx_int_t ngx_http_brotli_lookahead(ngx_http_request_t* r,
+                                           ngx_http_brotli_ctx_t* ctx,
+                                           ngx_chain_t** in);
+static BrotliEncoderMode ngx_http_brotli_lookahead_mode(ngx_buf_t* b);
+static void ngx_http_brotli_block_account(ngx_http_request_t* r,
+                                          ngx_http_brotli_ctx_t* ctx,
+                                          size_t input);
+
+/* Pushes input to encoder, accounting time spent in it. */
+static BROTLI_BOOL ngx_http_brotli_filter_compress(
+    ngx_http_brotli_ctx_t* ctx, BrotliEncoderOperation op,
+    size_t* available_input, const uint8_t** next_input_byte);
 
 static void* ngx_http_brotli_filter_alloc(void* opaque, size_t size);
 static void ngx_http_brotli_filter_free(void* opaque, void* address);
+static void ngx_http_brotli_filter_cleanup(void* data);
+
+static uint64_t ngx_http_brotli_monotonic_usec(void);
+static void ngx_http_brotli_stats_max(ngx_atomic_t* max,
+                                      ngx_atomic_uint_t value);
+static void ngx_http_brotli_memory_open(ngx_http_brotli_memory_t* m,
+                                        size_t size);
+static void ngx_http_brotli_worker_gauge(ngx_atomic_t* gauge, size_t* share,
+                                         size_t value);
+static size_t ngx_http_brotli_pool_bytes(ngx_pool_t* pool);
+static ngx_int_t ngx_http_brotli_tenant_open(ngx_http_request_t* r,
+                                             ngx_http_brotli_ctx_t* ctx,
+                                             ngx_int_t* quality);
+static void ngx_http_brotli_size_quality(ngx_http_brotli_conf_t* conf,
+                                         off_t content_length,
+                                         ngx_int_t* quality);
+static ngx_int_t ngx_http_brotli_eval_quality(ngx_http_request_t* r,
+                                              ngx_http_brotli_conf_t* conf,
+                                              ngx_int_t* quality);
+static ngx_int_t ngx_http_brotli_eval_window(ngx_http_request_t* r,
+                                             ngx_http_brotli_conf_t* conf,
+                                             size_t* lg_win);
 
 static ngx_int_t ngx_http_brotli_check_request(ngx_http_request_t* r);
 
@@ -102,12 +499,66 @@ static ngx_int_t ngx_http_brotli_add_variables(ngx_conf_t* cf);
 static ngx_int_t ngx_http_brotli_ratio_variable(ngx_http_request_t* r,
                                                 ngx_http_variable_value_t* v,
                                                 uintptr_t data);
-
+static ngx_int_t ngx_http_brotli_size_variable(ngx_http_request_t* r,
+                                               ngx_http_variable_value_t* v,
+                                               uintptr_t data);
+static ngx_int_t ngx_http_brotli_quality_variable(ngx_http_request_t* r,
+                                                  ngx_http_variable_value_t* v,
+                                                  uintptr_t data);
+static ngx_int_t ngx_http_brotli_window_variable(ngx_http_request_t* r,
+                                                 ngx_http_variable_value_t* v,
+                                                 uintptr_t data);
+static ngx_int_t ngx_http_brotli_time_variable(ngx_http_request_t* r,
+                                               ngx_http_variable_value_t* v,
+                                               uintptr_t data);
+static ngx_int_t ngx_http_brotli_flushes_variable(ngx_http_request_t* r,
+                                                  ngx_http_variable_value_t* v,
+                                                  uintptr_t data);
+static ngx_int_t ngx_http_brotli_skip_reason_variable(
+    ngx_http_request_t* r, ngx_http_variable_value_t* v, uintptr_t data);
+/* Returns NGX_HTTP_BROTLI_SKIP_* reason of request. */
+static ngx_uint_t ngx_http_brotli_skip_reason(ngx_http_request_t* r);
+static ngx_int_t ngx_http_brotli_skip(ngx_http_request_t* r,
+                                      ngx_uint_t reason);
+static ngx_int_t ngx_http_brotli_worker_memory_variable(
+    ngx_http_request_t* r, ngx_http_variable_value_t* v, uintptr_t data);
+
+static void* ngx_http_brotli_create_main_conf(ngx_conf_t* cf);
 static void* ngx_http_brotli_create_conf(ngx_conf_t* cf);
 static char* ngx_http_brotli_merge_conf(ngx_conf_t* cf, void* parent,
                                         void* child);
 static ngx_int_t ngx_http_brotli_filter_init(ngx_conf_t* cf);
 
+static char* ngx_http_brotli_stats_zone(ngx_conf_t* cf, ngx_command_t* cmd,
+                                        void* conf);
+static char* ngx_http_brotli_status(ngx_conf_t* cf, ngx_command_t* cmd,
+                                    void* conf);
+static char* ngx_http_brotli_merge_stats(ngx_conf_t* cf,
+                                         ngx_http_brotli_conf_t* prev,
+                                         ngx_http_brotli_conf_t* conf);
+static char* ngx_http_brotli_merge_tenant(ngx_conf_t* cf,
+                                          ngx_http_brotli_conf_t* conf);
+static ngx_int_t ngx_http_brotli_stats_init_zone(ngx_shm_zone_t* shm_zone,
+                                                 void* data);
+static ngx_int_t ngx_http_brotli_stats_log_handler(ngx_http_request_t* r);
+static char* ngx_http_brotli_tenant_quota(ngx_conf_t* cf, ngx_command_t* cmd,
+                                          void* conf);
+static char* ngx_http_brotli_comp_level(ngx_conf_t* cf, ngx_command_t* cmd,
+                                        void* conf);
+static char* ngx_http_brotli_window(ngx_conf_t* cf, ngx_command_t* cmd,
+                                    void* conf);
+static char* ngx_http_brotli_comp_level_by_size(ngx_conf_t* cf,
+                                                ngx_command_t* cmd,
+                                                void* conf);
+static char* ngx_http_brotli_event_log(ngx_conf_t* cf, ngx_command_t* cmd,
+                                       void* conf);
+static ngx_int_t ngx_http_brotli_event_log_handler(ngx_http_request_t* r);
+static void ngx_http_brotli_event_log_flush(ngx_open_file_t* file,
+                                            ngx_log_t* log);
+static void ngx_http_brotli_event_log_flush_handler(ngx_event_t* ev);
+static void ngx_http_brotli_exit_process(ngx_cycle_t* cycle);
+static ngx_int_t ngx_http_brotli_status_handler(ngx_http_request_t* r);
+
 static char* ngx_http_brotli_parse_wbits(ngx_conf_t* cf, void* post,
                                          void* data);
 
@@ -143,14 +594,19 @@ static ngx_command_t ngx_http_brotli_filter_commands[] = {
     {ngx_string("brotli_comp_level"),
      NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
          NGX_CONF_TAKE1,
-     ngx_conf_set_num_slot, NGX_HTTP_LOC_CONF_OFFSET,
+     ngx_http_brotli_comp_level, NGX_HTTP_LOC_CONF_OFFSET,
      offsetof(ngx_http_brotli_conf_t, quality),
      &ngx_http_brotli_comp_level_bounds},
 
+    {ngx_string("brotli_comp_level_by_size"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_CONF_1MORE,
+     ngx_http_brotli_comp_level_by_size, NGX_HTTP_LOC_CONF_OFFSET, 0, NULL},
+
     {ngx_string("brotli_window"),
      NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
          NGX_CONF_TAKE1,
-     ngx_conf_set_size_slot, NGX_HTTP_LOC_CONF_OFFSET,
+     ngx_http_brotli_window, NGX_HTTP_LOC_CONF_OFFSET,
      offsetof(ngx_http_brotli_conf_t, lg_win), &ngx_http_brotli_parse_wbits_p},
 
     {ngx_string("brotli_min_length"),
@@ -159,6 +615,38 @@ static ngx_command_t ngx_http_brotli_filter_commands[] = {
      ngx_conf_set_size_slot, NGX_HTTP_LOC_CONF_OFFSET,
      offsetof(ngx_http_brotli_conf_t, min_length), NULL},
 
+    {ngx_string("brotli_lookahead"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_CONF_TAKE1,
+     ngx_conf_set_size_slot, NGX_HTTP_LOC_CONF_OFFSET,
+     offsetof(ngx_http_brotli_conf_t, lookahead), NULL},
+
+    {ngx_string("brotli_stats_zone"), NGX_HTTP_MAIN_CONF | NGX_CONF_TAKE1,
+     ngx_http_brotli_stats_zone, NGX_HTTP_MAIN_CONF_OFFSET, 0, NULL},
+
+    {ngx_string("brotli_status"), NGX_HTTP_LOC_CONF | NGX_CONF_NOARGS,
+     ngx_http_brotli_status, NGX_HTTP_LOC_CONF_OFFSET, 0, NULL},
+
+    {ngx_string("brotli_event_log"), NGX_HTTP_MAIN_CONF | NGX_CONF_1MORE,
+     ngx_http_brotli_event_log, NGX_HTTP_MAIN_CONF_OFFSET, 0, NULL},
+
+    {ngx_string("brotli_block_warn"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_CONF_TAKE1,
+     ngx_conf_set_msec_slot, NGX_HTTP_LOC_CONF_OFFSET,
+     offsetof(ngx_http_brotli_conf_t, block_warn), NULL},
+
+    {ngx_string("brotli_tenant"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_CONF_TAKE1,
+     ngx_http_set_complex_value_slot, NGX_HTTP_LOC_CONF_OFFSET,
+     offsetof(ngx_http_brotli_conf_t, tenant), NULL},
+
+    {ngx_string("brotli_tenant_quota"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_CONF_TAKE123,
+     ngx_http_brotli_tenant_quota, NGX_HTTP_LOC_CONF_OFFSET, 0, NULL},
+
     ngx_null_command};
 
 /* Module context hooks. */
@@ -166,8 +654,8 @@ static ngx_http_module_t ngx_http_brotli_filter_module_ctx = {
     ngx_http_brotli_add_variables, /* pre-configuration */
     ngx_http_brotli_filter_init,   /* post-configuration */
 
-    NULL, /* create main configuration */
-    NULL, /* init main configuration */
+    ngx_http_brotli_create_main_conf, /* create main configuration */
+    NULL,                             /* init main configuration */
 
     NULL, /* create server configuration */
     NULL, /* merge server configuration */
@@ -187,17 +675,62 @@ ngx_module_t ngx_http_brotli_filter_module = {
     NULL,                               /* init process */
     NULL,                               /* init thread */
     NULL,                               /* exit thread */
-    NULL,                               /* exit process */
+    ngx_http_brotli_exit_process,       /* exit process */
     NULL,                               /* exit master */
     NGX_MODULE_V1_PADDING};
 
-/* Variable names. */
-static ngx_str_t ngx_http_brotli_ratio = ngx_string("brotli_ratio");
+/* Variables. */
+static ngx_http_variable_t ngx_http_brotli_vars[] = {
+    {ngx_string("brotli_ratio"), NULL, ngx_http_brotli_ratio_variable, 0, 0,
+     0},
+
+    {ngx_string("brotli_bytes_in"), NULL, ngx_http_brotli_size_variable,
+     offsetof(ngx_http_brotli_ctx_t, bytes_in), 0, 0},
+
+    {ngx_string("brotli_bytes_out"), NULL, ngx_http_brotli_size_variable,
+     offsetof(ngx_http_brotli_ctx_t, bytes_out), 0, 0},
+
+    {ngx_string("brotli_quality"), NULL, ngx_http_brotli_quality_variable, 0,
+     0, 0},
+
+    {ngx_string("brotli_window"), NULL, ngx_http_brotli_window_variable, 0, 0,
+     0},
+
+    {ngx_string("brotli_time"), NULL, ngx_http_brotli_time_variable,
+     offsetof(ngx_http_brotli_ctx_t, encoder_usec), 0, 0},
+
+    {ngx_string("brotli_block_time"), NULL, ngx_http_brotli_time_variable,
+     offsetof(ngx_http_brotli_ctx_t, block_max_usec), 0, 0},
+
+    {ngx_string("brotli_flushes"), NULL, ngx_http_brotli_flushes_variable, 0,
+     0, 0},
+
+    {ngx_string("brotli_peak_memory"), NULL, ngx_http_brotli_size_variable,
+     offsetof(ngx_http_brotli_ctx_t, peak_memory), 0, 0},
+
+    {ngx_string("brotli_skip_reason"), NULL,
+     ngx_http_brotli_skip_reason_variable, 0, 0, 0},
+
+    {ngx_string("brotli_worker_memory"), NULL,
+     ngx_http_brotli_worker_memory_variable,
+     offsetof(ngx_http_brotli_worker_t, memory.live), NGX_HTTP_VAR_NOCACHEABLE,
+     0},
+
+    {ngx_string("brotli_worker_peak_memory"), NULL,
+     ngx_http_brotli_worker_memory_variable,
+     offsetof(ngx_http_brotli_worker_t, memory.peak), NGX_HTTP_VAR_NOCACHEABLE,
+     0},
+
+    {ngx_null_string, NULL, NULL, 0, 0, 0}};
 
 /* Next filter in the filter chain. */
 static ngx_http_output_header_filter_pt ngx_http_next_header_filter;
 static ngx_http_output_body_filter_pt ngx_http_next_body_filter;
 
+/* Closed contexts of responses that are not compressed, by skip reason;
+   shared by requests, so never modified once filter is initialized. */
+static ngx_http_brotli_ctx_t ngx_http_brotli_skipped[NGX_HTTP_BROTLI_SKIP_N];
+
 static const char kEncoding[] = "br";
 static const size_t kEncodingLen = 2; /* strlen(kEncoding) */
 
@@ -284,49 +817,57 @@ static ngx_int_t ngx_http_brotli_header_filter(ngx_http_request_t* r) {
     return ngx_http_next_header_filter(r);
   }
 
+  if (r != r->main) {
+    return ngx_http_brotli_skip(r, NGX_HTTP_BROTLI_SKIP_SUBREQUEST);
+  }
+
   /* Only compress OK / forbidden / not found responses. */
   if (r->headers_out.status != NGX_HTTP_OK &&
       r->headers_out.status != NGX_HTTP_FORBIDDEN &&
       r->headers_out.status != NGX_HTTP_NOT_FOUND) {
-    return ngx_http_next_header_filter(r);
+    return ngx_http_brotli_skip(r, NGX_HTTP_BROTLI_SKIP_STATUS);
   }
 
   /* Bypass "header only" responses. */
   if (r->header_only) {
-    return ngx_http_next_header_filter(r);
+    return ngx_http_brotli_skip(r, NGX_HTTP_BROTLI_SKIP_HEADER_ONLY);
   }
 
   /* Bypass already compressed responses. */
   if (r->headers_out.content_encoding &&
       r->headers_out.content_encoding->value.len) {
-    return ngx_http_next_header_filter(r);
+    return ngx_http_brotli_skip(r, NGX_HTTP_BROTLI_SKIP_ENCODED);
   }
 
   /* If response size is known, do not compress tiny responses. */
   if (r->headers_out.content_length_n != -1 &&
       r->headers_out.content_length_n < conf->min_length) {
-    return ngx_http_next_header_filter(r);
+    return ngx_http_brotli_skip(r, NGX_HTTP_BROTLI_SKIP_MIN_LENGTH);
   }
 
   /* Compress only certain MIME-typed responses. */
   if (ngx_http_test_content_type(r, &conf->types) == NULL) {
-    return ngx_http_next_header_filter(r);
+    return ngx_http_brotli_skip(r, NGX_HTTP_BROTLI_SKIP_TYPE);
   }
 
   r->gzip_vary = 1;
 
   /* Check if client support brotli encoding. */
   if (ngx_http_brotli_check_request(r) != NGX_OK) {
-    return ngx_http_next_header_filter(r);
+    return ngx_http_brotli_skip(r, NGX_HTTP_BROTLI_SKIP_ACCEPT_ENCODING);
   }
 
+  ngx_http_brotli_probe2(header, r, r->headers_out.content_length_n);
+
   /* Prepare instance context. */
   ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_brotli_ctx_t));
   if (ctx == NULL) {
     return NGX_ERROR;
   }
   ctx->request = r;
+  ctx->pool = r->pool;
   ctx->content_length = r->headers_out.content_length_n;
+  ctx->start_usec = ngx_http_brotli_monotonic_usec();
   ngx_http_set_ctx(r, ctx, ngx_http_brotli_filter_module);
 
   /* Prepare response headers, so that following filters in the chain will
@@ -353,11 +894,110 @@ static ngx_int_t ngx_http_brotli_header_filter(ngx_http_request_t* r) {
   return ngx_http_next_header_filter(r);
 }
 
+/* Records why response is not compressed and passes it on. */
+static ngx_int_t ngx_http_brotli_skip(ngx_http_request_t* r,
+                                      ngx_uint_t reason) {
+  ngx_http_brotli_probe2(skip, r, ngx_http_brotli_skip_reasons[reason].data);
+
+  /* Most responses are not compressed; nothing is allocated for them. */
+  ngx_http_set_ctx(r, &ngx_http_brotli_skipped[reason],
+                   ngx_http_brotli_filter_module);
+
+  return ngx_http_next_header_filter(r);
+}
+
 /* Response body filtration (compression). */
 static ngx_int_t ngx_http_brotli_body_filter(ngx_http_request_t* r,
                                              ngx_chain_t* in) {
-  int rc;
   ngx_http_brotli_ctx_t* ctx;
+  ngx_int_t rc;
+  size_t bytes_in;
+  uint64_t encoder_usec;
+  uint64_t usec;
+
+  ctx = ngx_http_get_module_ctx(r, ngx_http_brotli_filter_module);
+
+  ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                 "http brotli filter");
+
+  if (ctx == NULL || ctx->closed || r->header_only) {
+    return ngx_http_next_body_filter(r, in);
+  }
+
+  ctx->block_usec = 0;
+  bytes_in = ctx->bytes_in;
+  encoder_usec = ctx->encoder_usec;
+
+  rc = ngx_http_brotli_body_filter_process(r, ctx, in);
+
+  if (ctx->block_usec) {
+    ngx_http_brotli_block_account(r, ctx, ctx->bytes_in - bytes_in);
+  }
+
+  /* Long responses are charged as they go, so that quota applies to
+     streams that start meanwhile. */
+  usec = ctx->encoder_usec - encoder_usec;
+  if (ctx->tenant && usec) {
+    (void)ngx_atomic_fetch_add(&ctx->tenant->usec, usec);
+    (void)ngx_atomic_fetch_add(&ctx->tenant->window_usec, usec);
+  }
+
+  return rc;
+}
+
+/* Worker-local blocked time within the current second. */
+static time_t ngx_http_brotli_block_second;
+static uint64_t ngx_http_brotli_block_second_usec;
+
+/* Accounts time the body filter call has spent in encoder. */
+static void ngx_http_brotli_block_account(ngx_http_request_t* r,
+                                          ngx_http_brotli_ctx_t* ctx,
+                                          size_t input) {
+  ngx_http_brotli_conf_t* conf;
+  ngx_http_brotli_worker_t* w;
+  ngx_uint_t slow;
+
+  if (ctx->block_usec > ctx->block_max_usec) {
+    ctx->block_max_usec = ctx->block_usec;
+  }
+
+  if (ngx_http_brotli_block_second != ngx_time()) {
+    ngx_http_brotli_block_second = ngx_time();
+    ngx_http_brotli_block_second_usec = 0;
+  }
+  ngx_http_brotli_block_second_usec += ctx->block_usec;
+
+  conf = ngx_http_get_module_loc_conf(r, ngx_http_brotli_filter_module);
+  slow = conf->block_warn &&
+         ctx->block_usec >= (uint64_t)conf->block_warn * 1000;
+
+  if (slow) {
+    ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                  "brotli encoder blocked for %uL.%03uLms, uri: \"%V\", "
+                  "input: %uz, total input: %uz, quality: %i",
+                  ctx->block_usec / 1000, ctx->block_usec % 1000, &r->uri,
+                  input, ctx->bytes_in, ctx->quality);
+  }
+
+  w = ctx->worker;
+  if (w == NULL) {
+    return;
+  }
+
+  (void)ngx_atomic_fetch_add(&w->blocks, 1);
+  (void)ngx_atomic_fetch_add(&w->block_usec, ctx->block_usec);
+  ngx_http_brotli_stats_max(&w->block_max_usec, ctx->block_usec);
+  ngx_http_brotli_stats_max(&w->block_second_max_usec,
+                            ngx_http_brotli_block_second_usec);
+  if (slow) {
+    (void)ngx_atomic_fetch_add(&w->slow_blocks, 1);
+  }
+}
+
+static ngx_int_t ngx_http_brotli_body_filter_process(ngx_http_request_t* r,
+                                                     ngx_http_brotli_ctx_t* ctx,
+                                                     ngx_chain_t* in) {
+  int rc;
   size_t available_output;
   ptrdiff_t available_busy_output;
   size_t input_size;
@@ -367,14 +1007,18 @@ static ngx_int_t ngx_http_brotli_body_filter(ngx_http_request_t* r,
   BROTLI_BOOL ok;
   u_char* out_ptr; /* Renamed from out to avoid conflict with ngx_chain_t *out */
   ngx_chain_t* link;
+  ngx_chain_t* cl;
+  size_t queued;
 
-  ctx = ngx_http_get_module_ctx(r, ngx_http_brotli_filter_module);
-
-  ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                 "http brotli filter");
-
-  if (ctx == NULL || ctx->closed || r->header_only) {
-    return ngx_http_next_body_filter(r, in);
+  if (!ctx->initialized && ctx->content_length == -1) {
+    rc = ngx_http_brotli_lookahead(r, ctx, &in);
+    if (rc == NGX_ERROR) {
+      ngx_http_brotli_filter_close(ctx);
+      return NGX_ERROR;
+    }
+    if (rc == NGX_OK) {
+      return NGX_OK;
+    }
   }
 
   if (ngx_http_brotli_filter_ensure_stream_initialized(r, ctx) != NGX_OK) {
@@ -389,6 +1033,17 @@ static ngx_int_t ngx_http_brotli_body_filter(ngx_http_request_t* r,
       return NGX_ERROR;
     }
     r->connection->buffered |= NGX_HTTP_BROTLI_BUFFERED;
+
+    if (ctx->worker) {
+      queued = ctx->queued_input;
+      for (cl = in; cl; cl = cl->next) {
+        queued += ngx_buf_size(cl->buf);
+      }
+      ngx_http_brotli_worker_gauge(&ctx->worker->queued_input,
+                                   &ctx->queued_input, queued);
+      ngx_http_brotli_worker_gauge(&ctx->worker->pool, &ctx->pool_bytes,
+                                   ngx_http_brotli_pool_bytes(r->pool));
+    }
   }
 
   /* Main loop:
@@ -407,6 +1062,8 @@ static ngx_int_t ngx_http_brotli_body_filter(ngx_http_request_t* r,
 
       rc = ngx_http_next_body_filter(r,
                                      ctx->output_ready ? ctx->out_chain : NULL);
+      ngx_http_brotli_probe4(handoff, r, ctx->output_ready,
+                             available_busy_output, rc);
       if (ctx->output_ready) {
         ctx->output_ready = 0;
         ctx->output_busy = 1;
@@ -422,7 +1079,10 @@ static ngx_int_t ngx_http_brotli_body_filter(ngx_http_request_t* r,
         }
         continue;
       } else if (rc == NGX_AGAIN) {
+        ngx_http_brotli_probe3(again, r, ctx->output_busy,
+                               ngx_buf_size(ctx->out_buf));
         if (ctx->output_busy) {
+          ctx->stalls++;
           /* Can't continue compression, let the outer filer decide. */
           if (ctx->in != NULL) {
             r->connection->buffered |= NGX_HTTP_BROTLI_BUFFERED;
@@ -463,6 +1123,11 @@ static ngx_int_t ngx_http_brotli_body_filter(ngx_http_request_t* r,
       }
       ctx->end_of_block = 0;
       ctx->output_ready = 1;
+      ngx_http_brotli_probe4(take, r, available_output, ctx->out_buf->flush,
+                             ctx->out_buf->last_buf);
+      if (ctx->first_byte_usec == 0) {
+        ctx->first_byte_usec = ngx_http_brotli_monotonic_usec();
+      }
       ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                      "brotli out: %p, size:%uz", ctx->out_buf,
                      ngx_buf_size(ctx->out_buf));
@@ -479,11 +1144,9 @@ static ngx_int_t ngx_http_brotli_body_filter(ngx_http_request_t* r,
     if (ctx->end_of_input) {
       // Ask the encoder to dump the leftover.
       available_input = 0;
-      available_output = 0; /* Encoder might still produce output */
       next_input_byte = NULL;
-      ok = BrotliEncoderCompressStream(ctx->encoder, BROTLI_OPERATION_FINISH,
-                                       &available_input, &next_input_byte,
-                                       &available_output, NULL, NULL);
+      ok = ngx_http_brotli_filter_compress(ctx, BROTLI_OPERATION_FINISH,
+                                           &available_input, &next_input_byte);
       r->connection->buffered |= NGX_HTTP_BROTLI_BUFFERED; /* May still buffer output */
       if (!ok) {
         ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
@@ -511,13 +1174,12 @@ static ngx_int_t ngx_http_brotli_body_filter(ngx_http_request_t* r,
 
     available_input = input_size;
     next_input_byte = (const uint8_t*)ctx->in->buf->pos;
-    available_output = 0; /* Encoder might still produce output */
-    ok = BrotliEncoderCompressStream(
-        ctx->encoder,
+    ok = ngx_http_brotli_filter_compress(
+        ctx,
         ctx->in->buf->last_buf ? BROTLI_OPERATION_FINISH
                                : ctx->in->buf->flush ? BROTLI_OPERATION_FLUSH
                                                      : BROTLI_OPERATION_PROCESS,
-        &available_input, &next_input_byte, &available_output, NULL, NULL);
+        &available_input, &next_input_byte);
     r->connection->buffered |= NGX_HTTP_BROTLI_BUFFERED; /* May still buffer output */
     if (!ok) {
       ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
@@ -529,12 +1191,18 @@ static ngx_int_t ngx_http_brotli_body_filter(ngx_http_request_t* r,
     consumed_input = input_size - available_input;
     ctx->bytes_in += consumed_input;
     ctx->in->buf->pos += consumed_input;
+    if (ctx->worker && consumed_input) {
+      ngx_http_brotli_worker_gauge(&ctx->worker->queued_input,
+                                   &ctx->queued_input,
+                                   ctx->queued_input - consumed_input);
+    }
 
     if (consumed_input == input_size) {
       if (ctx->in->buf->last_buf) {
         ctx->end_of_input = 1;
       } else if (ctx->in->buf->flush) {
         ctx->end_of_block = 1;
+        ctx->flushes++;
       }
       link = ctx->in;
       ctx->in = ctx->in->next;
@@ -565,11 +1233,101 @@ static ngx_int_t ngx_http_brotli_body_filter(ngx_http_request_t* r,
   return NGX_ERROR;
 }
 
+/* Holds head of response of unknown length, until "brotli_lookahead" bytes,
+   flush or end of response. Returns NGX_OK while holding, and NGX_DECLINED
+   once "in" is replaced with held data followed by the rest of input. */
+static ngx_int_t ngx_http_brotli_lookahead(ngx_http_request_t* r,
+                                           ngx_http_brotli_ctx_t* ctx,
+                                           ngx_chain_t** in) {
+  ngx_http_brotli_conf_t* conf;
+  ngx_chain_t* cl;
+  ngx_buf_t* b;
+  size_t size;
+  size_t n;
+
+  conf = ngx_http_get_module_loc_conf(r, ngx_http_brotli_filter_module);
+  if (conf->lookahead == 0 || ctx->lookahead_done) {
+    return NGX_DECLINED;
+  }
+
+  b = ctx->lookahead;
+  if (b == NULL) {
+    b = ngx_create_temp_buf(r->pool, conf->lookahead);
+    if (b == NULL) {
+      return NGX_ERROR;
+    }
+    ctx->lookahead = b;
+  }
+
+  /* Input is in memory, see ngx_http_brotli_header_filter(); copied bytes
+     are consumed, so that upstream buffers could be reused meanwhile. */
+  for (cl = *in; cl; cl = cl->next) {
+    size = cl->buf->last - cl->buf->pos;
+    n = ngx_min(size, (size_t)(b->end - b->last));
+    b->last = ngx_cpymem(b->last, cl->buf->pos, n);
+    cl->buf->pos += n;
+    if (n < size) {
+      break;
+    }
+    if (cl->buf->last_buf || cl->buf->flush) {
+      b->last_buf = cl->buf->last_buf;
+      b->flush = !cl->buf->last_buf;
+      cl = cl->next;
+      break;
+    }
+  }
+
+  if (b->last != b->end && !b->last_buf && !b->flush) {
+    r->connection->buffered |= NGX_HTTP_BROTLI_BUFFERED;
+    return NGX_OK;
+  }
+
+  ctx->lookahead_done = 1;
+  if (b->last_buf) {
+    /* Whole response is known; configure encoder as for static one. */
+    ctx->content_length = b->last - b->pos;
+  }
+
+  ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                 "brotli lookahead: %uz bytes, last:%d flush:%d",
+                 (size_t)(b->last - b->pos), b->last_buf, b->flush);
+
+  *in = ngx_alloc_chain_link(r->pool);
+  if (*in == NULL) {
+    return NGX_ERROR;
+  }
+  (*in)->buf = b;
+  (*in)->next = cl;
+
+  return NGX_DECLINED;
+}
+
+/* Text mode, unless sample has control characters other than whitespace. */
+static BrotliEncoderMode ngx_http_brotli_lookahead_mode(ngx_buf_t* b) {
+  u_char* p;
+
+  for (p = b->pos; p < b->last; p++) {
+    if (*p < 0x20 && *p != '\t' && *p != '\n' && *p != '\r' && *p != '\f') {
+      return BROTLI_MODE_GENERIC;
+    }
+    if (*p == 0x7f) {
+      return BROTLI_MODE_GENERIC;
+    }
+  }
+
+  return BROTLI_MODE_TEXT;
+}
+
 static ngx_int_t ngx_http_brotli_filter_ensure_stream_initialized(
     ngx_http_request_t* r, ngx_http_brotli_ctx_t* ctx) {
+  ngx_http_brotli_main_conf_t* mcf;
   ngx_http_brotli_conf_t* conf;
+  ngx_pool_cleanup_t* cln;
   BROTLI_BOOL ok;
+  ngx_int_t quality;
+  size_t lg_win;
   size_t wbits;
+  BrotliEncoderMode mode;
 
   if (ctx->initialized) {
     return NGX_OK;
@@ -578,26 +1336,61 @@ static ngx_int_t ngx_http_brotli_filter_ensure_stream_initialized(
 
   conf = ngx_http_get_module_loc_conf(r, ngx_http_brotli_filter_module);
 
+  lg_win = conf->lg_win;
+  if (conf->lg_win_value &&
+      ngx_http_brotli_eval_window(r, conf, &lg_win) != NGX_OK) {
+    return NGX_ERROR;
+  }
+
   /* Tune lg_win, if size is known. */
   if (ctx->content_length > 0 && ctx->content_length <= (1 << BROTLI_MAX_WINDOW_BITS)) {
     wbits = BROTLI_MIN_WINDOW_BITS;
-    /* Find smallest window that is still >= content_length, up to conf->lg_win */
+    /* Find smallest window that is still >= content_length, up to lg_win */
     while ( (1u << wbits) < (size_t)ctx->content_length && wbits < BROTLI_MAX_WINDOW_BITS) {
         wbits++;
     }
-    if (wbits > conf->lg_win) { /* respect configured max window */
-        wbits = conf->lg_win;
+    if (wbits > lg_win) { /* respect configured max window */
+        wbits = lg_win;
     }
   } else {
-    wbits = conf->lg_win;
+    wbits = lg_win;
   }
   /* Ensure wbits is within Brotli's valid range, just in case. */
   if (wbits < BROTLI_MIN_WINDOW_BITS) wbits = BROTLI_MIN_WINDOW_BITS;
   if (wbits > BROTLI_MAX_WINDOW_BITS) wbits = BROTLI_MAX_WINDOW_BITS;
 
+  mcf = ngx_http_get_module_main_conf(r, ngx_http_brotli_filter_module);
+  if (mcf->stats_sh && ngx_worker < mcf->stats_sh->nworkers) {
+    /* Aborted requests are not closed; shared accounting has to be. */
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+      return NGX_ERROR;
+    }
+    cln->handler = ngx_http_brotli_filter_cleanup;
+    cln->data = ctx;
+
+    ctx->worker = &mcf->stats_sh->workers[ngx_worker];
+    ctx->worker_memory = &ctx->worker->memory;
+    ngx_http_brotli_memory_open(ctx->worker_memory, 0);
+  }
+
+  quality = conf->quality;
+  if (conf->size_levels) {
+    ngx_http_brotli_size_quality(conf, ctx->content_length, &quality);
+  }
+
+  if (conf->quality_value &&
+      ngx_http_brotli_eval_quality(r, conf, &quality) != NGX_OK) {
+    return NGX_ERROR;
+  }
+
+  if (conf->tenant &&
+      ngx_http_brotli_tenant_open(r, ctx, &quality) != NGX_OK) {
+    return NGX_ERROR;
+  }
 
   ctx->encoder = BrotliEncoderCreateInstance(
-      ngx_http_brotli_filter_alloc, ngx_http_brotli_filter_free, r->pool);
+      ngx_http_brotli_filter_alloc, ngx_http_brotli_filter_free, ctx);
   if (ctx->encoder == NULL) {
     ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
                   "OOM / BrotliEncoderCreateInstance");
@@ -605,11 +1398,11 @@ static ngx_int_t ngx_http_brotli_filter_ensure_stream_initialized(
   }
 
   ok = BrotliEncoderSetParameter(ctx->encoder, BROTLI_PARAM_QUALITY,
-                                 (uint32_t)conf->quality);
+                                 (uint32_t)quality);
   if (!ok) {
     ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
                   "BrotliEncoderSetParameter(QUALITY, %uD) failed",
-                  (uint32_t)conf->quality);
+                  (uint32_t)quality);
     return NGX_ERROR;
   }
 
@@ -622,6 +1415,41 @@ static ngx_int_t ngx_http_brotli_filter_ensure_stream_initialized(
     return NGX_ERROR;
   }
 
+  if (ctx->lookahead) {
+    mode = ngx_http_brotli_lookahead_mode(ctx->lookahead);
+    ok = BrotliEncoderSetParameter(ctx->encoder, BROTLI_PARAM_MODE,
+                                   (uint32_t)mode);
+    if (!ok) {
+      ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                    "BrotliEncoderSetParameter(MODE, %uD) failed",
+                    (uint32_t)mode);
+      return NGX_ERROR;
+    }
+
+    /* Response ended within lookahead and is compressed at once. */
+    if (ctx->lookahead->last_buf) {
+      ok = BrotliEncoderSetParameter(ctx->encoder, BROTLI_PARAM_SIZE_HINT,
+                                     (uint32_t)ctx->content_length);
+      if (!ok) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                      "BrotliEncoderSetParameter(SIZE_HINT, %O) failed",
+                      ctx->content_length);
+        return NGX_ERROR;
+      }
+    }
+  }
+
+  ctx->quality = quality;
+  ctx->lg_win = wbits;
+  ctx->timed = mcf->timing || conf->block_warn || conf->tenant;
+
+  if (ctx->worker_memory) {
+    /* Instance itself is already allocated. */
+    ctx->encoder_memory =
+        &mcf->stats_sh->encoders[ctx->quality][wbits - BROTLI_MIN_WINDOW_BITS];
+    ngx_http_brotli_memory_open(ctx->encoder_memory, ctx->memory);
+  }
+
   ctx->out_buf = ngx_calloc_buf(r->pool);
   if (ctx->out_buf == NULL) {
     return NGX_ERROR;
@@ -635,53 +1463,430 @@ static ngx_int_t ngx_http_brotli_filter_ensure_stream_initialized(
   ctx->out_chain->buf = ctx->out_buf;
   ctx->out_chain->next = NULL;
 
+  ngx_http_brotli_probe4(init, r, ctx->quality, ctx->lg_win,
+                         ctx->content_length);
+
   ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                 "brotli encoder initialized: lvl:%i win:%uz (derived from content_length %O)", conf->quality,
+                 "brotli encoder initialized: lvl:%i win:%uz (derived from content_length %O)", quality,
                  wbits, ctx->content_length);
 
   return NGX_OK;
 }
 
-static void* ngx_http_brotli_filter_alloc(void* opaque, size_t size) {
-  ngx_pool_t* pool = opaque;
-  void* p;
-
-  p = ngx_palloc(pool, size);
+/* Quality of brotli_comp_level_by_size tier that response falls into. */
+static void ngx_http_brotli_size_quality(ngx_http_brotli_conf_t* conf,
+                                         off_t content_length,
+                                         ngx_int_t* quality) {
+  ngx_http_brotli_size_level_t* sl;
+  ngx_uint_t i;
 
-#if (NGX_DEBUG)
-  ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pool->log, 0, "brotli alloc: %p, size:%uz",
-                 p, size);
-#endif
+  if (content_length < 0) {
+    if (conf->size_unknown_level != -1) {
+      *quality = conf->size_unknown_level;
+    }
+    return;
+  }
 
-  return p;
+  sl = conf->size_levels->elts;
+  for (i = 0; i < conf->size_levels->nelts; i++) {
+    if (content_length >= sl[i].min && content_length < sl[i].max) {
+      *quality = sl[i].quality;
+      return;
+    }
+  }
 }
 
-static void ngx_http_brotli_filter_free(void* opaque, void* address) {
-  ngx_pool_t* pool = opaque;
+/* Quality of brotli_comp_level with variables. */
+static ngx_int_t ngx_http_brotli_eval_quality(ngx_http_request_t* r,
+                                              ngx_http_brotli_conf_t* conf,
+                                              ngx_int_t* quality) {
+  ngx_str_t value;
+  ngx_int_t n;
 
-#if (NGX_DEBUG)
-  ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pool->log, 0, "brotli free: %p", address);
-#endif
+  if (ngx_http_complex_value(r, conf->quality_value, &value) != NGX_OK) {
+    return NGX_ERROR;
+  }
+
+  if (value.len == 0) {
+    return NGX_OK;
+  }
 
-  ngx_pfree(pool, address);
+  n = ngx_atoi(value.data, value.len);
+  if (n < BROTLI_MIN_QUALITY || n > BROTLI_MAX_QUALITY) {
+    ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                  "invalid brotli_comp_level \"%V\", using %i", &value,
+                  *quality);
+    return NGX_OK;
+  }
+
+  *quality = n;
+
+  return NGX_OK;
 }
 
-static void ngx_http_brotli_filter_close(ngx_http_brotli_ctx_t* ctx) {
-  if (ctx->closed) {
-      return;
+/* Window bits of brotli_window with variables. */
+static ngx_int_t ngx_http_brotli_eval_window(ngx_http_request_t* r,
+                                             ngx_http_brotli_conf_t* conf,
+                                             size_t* lg_win) {
+  ngx_str_t value;
+  ssize_t size;
+  size_t bits;
+
+  if (ngx_http_complex_value(r, conf->lg_win_value, &value) != NGX_OK) {
+    return NGX_ERROR;
   }
-  ctx->closed = 1;
-  if (ctx->encoder) {
-    BrotliEncoderDestroyInstance(ctx->encoder);
-    ctx->encoder = NULL;
+
+  if (value.len == 0) {
+    return NGX_OK;
   }
-  /* Output chain and buffer are pool allocated, will be freed with the pool.
-     No explicit free here unless they were allocated differently or need
-     special handling beyond pool cleanup. ngx_free_chain and ngx_pfree
-     are generally for objects that might need freeing before pool destruction,
-     or if allocated outside the request pool.
-     Given they are from r->pool, explicit free might be redundant
-     but doesn't hurt if done carefully.
+
+  size = ngx_parse_size(&value);
+
+  for (bits = BROTLI_MIN_WINDOW_BITS; bits <= BROTLI_MAX_WINDOW_BITS; bits++) {
+    if (size == (ssize_t)1 << bits) {
+      *lg_win = bits;
+      return NGX_OK;
+    }
+  }
+
+  ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                "invalid brotli_window \"%V\", using %uz", &value,
+                (size_t)1 << *lg_win);
+
+  return NGX_OK;
+}
+
+static ngx_http_brotli_tenant_t* ngx_http_brotli_tenant_lookup(
+    ngx_http_brotli_main_conf_t* mcf, ngx_str_t* key, uint32_t hash) {
+  ngx_http_brotli_tenant_t* t;
+
+  t = (ngx_http_brotli_tenant_t*)ngx_str_rbtree_lookup(
+      &mcf->stats_sh->tenant_rbtree, key, hash);
+  if (t) {
+    return t;
+  }
+
+  t = ngx_slab_alloc_locked(
+      mcf->stats_shpool, offsetof(ngx_http_brotli_tenant_t, data) + key->len);
+  if (t == NULL) {
+    return NULL;
+  }
+
+  ngx_memzero(t, offsetof(ngx_http_brotli_tenant_t, data));
+  ngx_memcpy(t->data, key->data, key->len);
+  t->sn.node.key = hash;
+  t->sn.str.len = key->len;
+  t->sn.str.data = t->data;
+  t->window_start = ngx_time();
+
+  ngx_rbtree_insert(&mcf->stats_sh->tenant_rbtree, &t->sn.node);
+
+  /* Node must be complete before it is visible to status handler. */
+  t->next = mcf->stats_sh->tenants;
+  ngx_memory_barrier();
+  mcf->stats_sh->tenants = t;
+
+  return t;
+}
+
+/* Binds stream to its tenant, and applies tenant quota to quality. */
+static ngx_int_t ngx_http_brotli_tenant_open(ngx_http_request_t* r,
+                                             ngx_http_brotli_ctx_t* ctx,
+                                             ngx_int_t* quality) {
+  ngx_http_brotli_main_conf_t* mcf;
+  ngx_http_brotli_conf_t* conf;
+  ngx_http_brotli_tenant_t* t;
+  ngx_atomic_uint_t start;
+  ngx_atomic_uint_t usec;
+  ngx_str_t key;
+  uint32_t hash;
+  time_t now;
+
+  mcf = ngx_http_get_module_main_conf(r, ngx_http_brotli_filter_module);
+  conf = ngx_http_get_module_loc_conf(r, ngx_http_brotli_filter_module);
+
+  if (mcf->stats_sh == NULL) {
+    return NGX_OK;
+  }
+
+  if (ngx_http_complex_value(r, conf->tenant, &key) != NGX_OK) {
+    return NGX_ERROR;
+  }
+
+  if (key.len > NGX_HTTP_BROTLI_TENANT_LEN) {
+    key.len = NGX_HTTP_BROTLI_TENANT_LEN;
+  }
+  hash = ngx_crc32_short(key.data, key.len);
+
+  ngx_shmtx_lock(&mcf->stats_shpool->mutex);
+  t = ngx_http_brotli_tenant_lookup(mcf, &key, hash);
+  ngx_shmtx_unlock(&mcf->stats_shpool->mutex);
+
+  if (t == NULL) {
+    /* Zone is full; stream is not accounted. */
+    return NGX_OK;
+  }
+
+  ctx->tenant = t;
+  (void)ngx_atomic_fetch_add(&t->streams, 1);
+
+  if (conf->tenant_quota == 0) {
+    return NGX_OK;
+  }
+
+  /* Fixed windows; the worker that notices expiry starts the next one.
+     Usage is taken away atomically, so that charges other workers add
+     meanwhile stay in the new window. */
+  now = ngx_time();
+  start = t->window_start;
+  if (now - (time_t)start >= conf->tenant_window) {
+    if (ngx_atomic_cmp_set(&t->window_start, start, now)) {
+      usec = t->window_usec;
+      (void)ngx_atomic_fetch_add(&t->window_usec, -(ngx_atomic_int_t)usec);
+    }
+    return NGX_OK;
+  }
+
+  if (t->window_usec < (ngx_atomic_uint_t)conf->tenant_quota * 1000) {
+    return NGX_OK;
+  }
+
+  (void)ngx_atomic_fetch_add(&t->over_quota, 1);
+
+  if (conf->tenant_degrade >= 0 && *quality > conf->tenant_degrade) {
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "brotli tenant \"%V\" over quota, quality %i -> %i",
+                   &t->sn.str, *quality, conf->tenant_degrade);
+    *quality = conf->tenant_degrade;
+    (void)ngx_atomic_fetch_add(&t->degraded, 1);
+  }
+
+  return NGX_OK;
+}
+
+/* Raises shared maximum up to value. */
+static void ngx_http_brotli_stats_max(ngx_atomic_t* max,
+                                      ngx_atomic_uint_t value) {
+  ngx_atomic_uint_t old;
+
+  for (old = *max; old < value; old = *max) {
+    if (ngx_atomic_cmp_set(max, old, value)) {
+      break;
+    }
+  }
+}
+
+static void ngx_http_brotli_memory_add(ngx_http_brotli_memory_t* m,
+                                       size_t size) {
+  ngx_atomic_uint_t live;
+
+  live = ngx_atomic_fetch_add(&m->live, (ngx_atomic_int_t)size) + size;
+  ngx_http_brotli_stats_max(&m->peak, live);
+}
+
+static void ngx_http_brotli_memory_sub(ngx_http_brotli_memory_t* m,
+                                       size_t size) {
+  (void)ngx_atomic_fetch_add(&m->live, -(ngx_atomic_int_t)size);
+}
+
+/* Accounts new encoder that has already allocated size bytes. */
+static void ngx_http_brotli_memory_open(ngx_http_brotli_memory_t* m,
+                                        size_t size) {
+  (void)ngx_atomic_fetch_add(&m->encoders, 1);
+  (void)ngx_atomic_fetch_add(&m->streams, 1);
+  if (size) {
+    ngx_http_brotli_memory_add(m, size);
+  }
+}
+
+/* Accounts destroyed encoder; its memory is already released. */
+static void ngx_http_brotli_memory_close(ngx_http_brotli_memory_t* m,
+                                         size_t peak) {
+  (void)ngx_atomic_fetch_add(&m->encoders, -1);
+  ngx_http_brotli_stats_max(&m->stream_peak, peak);
+}
+
+/* Moves share of stream in worker gauge to value. */
+static void ngx_http_brotli_worker_gauge(ngx_atomic_t* gauge, size_t* share,
+                                         size_t value) {
+  (void)ngx_atomic_fetch_add(
+      gauge, (ngx_atomic_int_t)value - (ngx_atomic_int_t)*share);
+  *share = value;
+}
+
+/* Bytes used in blocks of pool; large allocations are not counted, as their
+   sizes are not kept. */
+static size_t ngx_http_brotli_pool_bytes(ngx_pool_t* pool) {
+  ngx_pool_t* p;
+  size_t bytes;
+
+  bytes = 0;
+  for (p = pool; p; p = p->d.next) {
+    bytes += p->d.last - (u_char*)p;
+  }
+
+  return bytes;
+}
+
+/* Returns monotonic wall-clock time, in microseconds. */
+static uint64_t ngx_http_brotli_monotonic_usec(void) {
+#if (NGX_HAVE_CLOCK_MONOTONIC)
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+  }
+#endif
+  {
+    struct timeval tv;
+    ngx_gettimeofday(&tv);
+    return (uint64_t)tv.tv_sec * 1000000 + (uint64_t)tv.tv_usec;
+  }
+}
+
+/* Returns CPU time consumed by the calling thread, in microseconds; where
+   thread CPU clock is not available, monotonic wall-clock time. */
+static uint64_t ngx_http_brotli_cpu_usec(void) {
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+  }
+#endif
+  return ngx_http_brotli_monotonic_usec();
+}
+
+static BROTLI_BOOL ngx_http_brotli_filter_compress(
+    ngx_http_brotli_ctx_t* ctx, BrotliEncoderOperation op,
+    size_t* available_input, const uint8_t** next_input_byte) {
+  BROTLI_BOOL ok;
+  size_t available_output;
+  uint64_t start;
+  uint64_t start_wall;
+  uint64_t usec;
+#if (NGX_HTTP_BROTLI_USDT)
+  size_t input_size = *available_input;
+#endif
+
+  available_output = 0; /* Encoder might still produce output */
+
+  /* Clock reads are system calls; skipped, if nobody needs the time.
+     Tracepoints do not need it: "compress" reports 0 for untimed streams. */
+  if (!ctx->timed) {
+    ok = BrotliEncoderCompressStream(ctx->encoder, op, available_input,
+                                     next_input_byte, &available_output, NULL,
+                                     NULL);
+    ngx_http_brotli_probe5(compress, ctx->request, op,
+                           input_size - *available_input, 0, ok);
+    return ok;
+  }
+
+  start_wall = ngx_http_brotli_monotonic_usec();
+  start = ngx_http_brotli_cpu_usec();
+  ok = BrotliEncoderCompressStream(ctx->encoder, op, available_input,
+                                   next_input_byte, &available_output, NULL,
+                                   NULL);
+  usec = ngx_http_brotli_cpu_usec() - start;
+  ctx->encoder_usec += usec;
+  ctx->block_usec += ngx_http_brotli_monotonic_usec() - start_wall;
+
+  /* Produced bytes are reported by "take" probe. */
+  ngx_http_brotli_probe5(compress, ctx->request, op,
+                         input_size - *available_input, usec, ok);
+
+  return ok;
+}
+
+static void* ngx_http_brotli_filter_alloc(void* opaque, size_t size) {
+  ngx_http_brotli_ctx_t* ctx = opaque;
+  ngx_pool_t* pool = ctx->pool;
+  u_char* p;
+
+  p = ngx_palloc(pool, size + NGX_HTTP_BROTLI_ALLOC_HEADER_SIZE);
+
+#if (NGX_DEBUG)
+  ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pool->log, 0, "brotli alloc: %p, size:%uz",
+                 p, size);
+#endif
+
+  if (p == NULL) {
+    return NULL;
+  }
+
+  *(size_t*)p = size;
+  ctx->memory += size;
+  if (ctx->memory > ctx->peak_memory) {
+    ctx->peak_memory = ctx->memory;
+  }
+
+  if (ctx->worker_memory) {
+    ngx_http_brotli_memory_add(ctx->worker_memory, size);
+  }
+  if (ctx->encoder_memory) {
+    ngx_http_brotli_memory_add(ctx->encoder_memory, size);
+  }
+
+  return p + NGX_HTTP_BROTLI_ALLOC_HEADER_SIZE;
+}
+
+static void ngx_http_brotli_filter_free(void* opaque, void* address) {
+  ngx_http_brotli_ctx_t* ctx = opaque;
+  ngx_pool_t* pool = ctx->pool;
+  u_char* p;
+
+#if (NGX_DEBUG)
+  ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pool->log, 0, "brotli free: %p", address);
+#endif
+
+  if (address == NULL) {
+    return;
+  }
+
+  p = (u_char*)address - NGX_HTTP_BROTLI_ALLOC_HEADER_SIZE;
+  ctx->memory -= *(size_t*)p;
+
+  if (ctx->worker_memory) {
+    ngx_http_brotli_memory_sub(ctx->worker_memory, *(size_t*)p);
+  }
+  if (ctx->encoder_memory) {
+    ngx_http_brotli_memory_sub(ctx->encoder_memory, *(size_t*)p);
+  }
+
+  ngx_pfree(pool, p);
+}
+
+static void ngx_http_brotli_filter_close(ngx_http_brotli_ctx_t* ctx) {
+  if (ctx->closed) {
+      return;
+  }
+  ctx->closed = 1;
+  ngx_http_brotli_probe5(close, ctx->request, ctx->success, ctx->bytes_in,
+                         ctx->bytes_out, ctx->encoder_usec);
+  if (ctx->encoder) {
+    BrotliEncoderDestroyInstance(ctx->encoder);
+    ctx->encoder = NULL;
+  }
+  if (ctx->worker_memory) {
+    ngx_http_brotli_memory_close(ctx->worker_memory, ctx->peak_memory);
+    ctx->worker_memory = NULL;
+  }
+  if (ctx->encoder_memory) {
+    ngx_http_brotli_memory_close(ctx->encoder_memory, ctx->peak_memory);
+    ctx->encoder_memory = NULL;
+  }
+  if (ctx->worker) {
+    ngx_http_brotli_worker_gauge(&ctx->worker->queued_input,
+                                 &ctx->queued_input, 0);
+    ngx_http_brotli_worker_gauge(&ctx->worker->pool, &ctx->pool_bytes, 0);
+  }
+  /* Output chain and buffer are pool allocated, will be freed with the pool.
+     No explicit free here unless they were allocated differently or need
+     special handling beyond pool cleanup. ngx_free_chain and ngx_pfree
+     are generally for objects that might need freeing before pool destruction,
+     or if allocated outside the request pool.
+     Given they are from r->pool, explicit free might be redundant
+     but doesn't hurt if done carefully.
   */
   if (ctx->out_chain) {
     /* ngx_alloc_chain_link allocates from pool, no explicit free needed here usually */
@@ -693,6 +1898,11 @@ static void ngx_http_brotli_filter_close(ngx_http_brotli_ctx_t* ctx) {
   }
 }
 
+/* Request pool is being destroyed; encoder memory is still valid. */
+static void ngx_http_brotli_filter_cleanup(void* data) {
+  ngx_http_brotli_filter_close(data);
+}
+
 static ngx_int_t ngx_http_brotli_check_request(ngx_http_request_t* req) {
   if (req != req->main) return NGX_DECLINED;
   if (check_accept_encoding(req) != NGX_OK) return NGX_DECLINED;
@@ -703,17 +1913,42 @@ static ngx_int_t ngx_http_brotli_check_request(ngx_http_request_t* req) {
 
 static ngx_int_t ngx_http_brotli_add_variables(ngx_conf_t* cf) {
   ngx_http_variable_t* var;
+  ngx_http_variable_t* v;
 
-  var = ngx_http_add_variable(cf, &ngx_http_brotli_ratio, 0);
-  if (var == NULL) {
-    return NGX_ERROR;
-  }
+  for (v = ngx_http_brotli_vars; v->name.len; v++) {
+    var = ngx_http_add_variable(cf, &v->name, v->flags);
+    if (var == NULL) {
+      return NGX_ERROR;
+    }
 
-  var->get_handler = ngx_http_brotli_ratio_variable;
+    var->get_handler = v->get_handler;
+    var->data = v->data;
+  }
 
   return NGX_OK;
 }
 
+/* Returns context of the request, if encoder has been set up for it;
+   otherwise marks variable as not found and returns NULL. */
+static ngx_http_brotli_ctx_t* ngx_http_brotli_variable_ctx(
+    ngx_http_request_t* r, ngx_http_variable_value_t* v) {
+  ngx_http_brotli_ctx_t* ctx;
+
+  v->valid = 1;
+  v->no_cacheable = 0;
+  v->not_found = 0;
+
+  ctx = ngx_http_get_module_ctx(r, ngx_http_brotli_filter_module);
+
+  /* lg_win is never 0 once encoder parameters are set. */
+  if (ctx == NULL || ctx->lg_win == 0) {
+    v->not_found = 1;
+    return NULL;
+  }
+
+  return ctx;
+}
+
 static ngx_int_t ngx_http_brotli_ratio_variable(ngx_http_request_t* r,
                                                 ngx_http_variable_value_t* v,
                                                 uintptr_t data) {
@@ -759,84 +1994,2497 @@ static ngx_int_t ngx_http_brotli_ratio_variable(ngx_http_request_t* r,
   return NGX_OK;
 }
 
-static void* ngx_http_brotli_create_conf(ngx_conf_t* cf) {
-  ngx_http_brotli_conf_t* conf;
+/* Reports one of size_t counters of the context; data is its offset. */
+static ngx_int_t ngx_http_brotli_size_variable(ngx_http_request_t* r,
+                                               ngx_http_variable_value_t* v,
+                                               uintptr_t data) {
+  ngx_http_brotli_ctx_t* ctx;
 
-  conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_brotli_conf_t));
-  if (conf == NULL) {
-    return NULL;
+  ctx = ngx_http_brotli_variable_ctx(r, v);
+  if (ctx == NULL) {
+    return NGX_OK;
   }
 
-  /* ngx_pcalloc fills result with zeros ->
-       conf->bufs.num = 0;
-       conf->types = { NULL };
-       conf->types_keys = NULL; */
-
-  conf->enable = NGX_CONF_UNSET;
+  v->data = ngx_pnalloc(r->pool, NGX_SIZE_T_LEN);
+  if (v->data == NULL) {
+    return NGX_ERROR;
+  }
 
-  conf->quality = NGX_CONF_UNSET;
-  conf->lg_win = NGX_CONF_UNSET_SIZE;
-  conf->min_length = NGX_CONF_UNSET;
+  v->len = ngx_sprintf(v->data, "%uz", *(size_t*)((u_char*)ctx + data)) -
+           v->data;
 
-  return conf;
+  return NGX_OK;
 }
 
-static char* ngx_http_brotli_merge_conf(ngx_conf_t* cf, void* parent,
-                                        void* child) {
-  ngx_http_brotli_conf_t* prev = parent;
-  ngx_http_brotli_conf_t* conf = child;
-  char* rc;
-
-  ngx_conf_merge_value(conf->enable, prev->enable, 0);
+static ngx_int_t ngx_http_brotli_quality_variable(ngx_http_request_t* r,
+                                                  ngx_http_variable_value_t* v,
+                                                  uintptr_t data) {
+  ngx_http_brotli_ctx_t* ctx;
 
-  ngx_conf_merge_value(conf->quality, prev->quality, 6); /* Default quality 6 */
-  /* Default lg_win: Brotli default is 22. Nginx default was 19 (512k).
-     BrotliEncoderDEFAULT_WINDOW is 22.
-     Let's align with a common default or make it explicit.
-     The original code used 19 (512k).
-     BROTLI_DEFAULT_WINDOW is usually 22. Max is 24. Min is 10.
-  */
-  ngx_conf_merge_size_value(conf->lg_win, prev->lg_win, BROTLI_DEFAULT_WINDOW);
-  ngx_conf_merge_value(conf->min_length, prev->min_length, 20); /* Default min_length 20 bytes */
+  ctx = ngx_http_brotli_variable_ctx(r, v);
+  if (ctx == NULL) {
+    return NGX_OK;
+  }
 
-  rc = ngx_http_merge_types(cf, &conf->types_keys, &conf->types,
-                            &prev->types_keys, &prev->types,
-                            ngx_http_html_default_types);
-  if (rc != NGX_CONF_OK) {
-    return NGX_CONF_ERROR;
+  v->data = ngx_pnalloc(r->pool, NGX_INT_T_LEN);
+  if (v->data == NULL) {
+    return NGX_ERROR;
   }
 
-  return NGX_CONF_OK;
+  v->len = ngx_sprintf(v->data, "%i", ctx->quality) - v->data;
+
+  return NGX_OK;
 }
 
-/* Prepend to filter chain. */
-static ngx_int_t ngx_http_brotli_filter_init(ngx_conf_t* cf) {
-  ngx_http_next_header_filter = ngx_http_top_header_filter;
-  ngx_http_top_header_filter = ngx_http_brotli_header_filter;
+/* Window is reported in bytes, same units as "brotli_window" directive. */
+static ngx_int_t ngx_http_brotli_window_variable(ngx_http_request_t* r,
+                                                 ngx_http_variable_value_t* v,
+                                                 uintptr_t data) {
+  ngx_http_brotli_ctx_t* ctx;
 
-  ngx_http_next_body_filter = ngx_http_top_body_filter;
-  ngx_http_top_body_filter = ngx_http_brotli_body_filter;
+  ctx = ngx_http_brotli_variable_ctx(r, v);
+  if (ctx == NULL) {
+    return NGX_OK;
+  }
+
+  v->data = ngx_pnalloc(r->pool, NGX_SIZE_T_LEN);
+  if (v->data == NULL) {
+    return NGX_ERROR;
+  }
+
+  v->len = ngx_sprintf(v->data, "%uz", (size_t)1 << ctx->lg_win) - v->data;
 
   return NGX_OK;
 }
 
-/* Translate "window size" to window bits (log2), and check bounds. */
-static char* ngx_http_brotli_parse_wbits(ngx_conf_t* cf, void* post,
-                                         void* data) {
-  size_t* parameter = data; /* This is where lg_win (which is actually size in bytes) is stored by ngx_conf_set_size_slot */
-  size_t wsize_bytes = *parameter;
-  size_t bits;
+/* Reports one of microsecond times of the context, in seconds with
+   microsecond resolution; data is its offset. */
+static ngx_int_t ngx_http_brotli_time_variable(ngx_http_request_t* r,
+                                               ngx_http_variable_value_t* v,
+                                               uintptr_t data) {
+  ngx_http_brotli_ctx_t* ctx;
+  uint64_t usec;
 
-  /* Find the closest power of 2 for window bits that matches the size */
-  for (bits = BROTLI_MIN_WINDOW_BITS; bits <= BROTLI_MAX_WINDOW_BITS; bits++) {
-    if (wsize_bytes == (1u << bits)) {
-      *parameter = bits; /* Store the bits value */
-      return NGX_CONF_OK;
-    }
+  ctx = ngx_http_brotli_variable_ctx(r, v);
+  if (ctx == NULL) {
+    return NGX_OK;
   }
-  
-  /* If an exact power-of-2 match isn't found from the typical list */
-  ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                       "invalid brotli_window value \"%uz\", must be a power of 2 between 1k (for 10 bits) and 16m (for 24 bits)", wsize_bytes);
-  return "must be 1k, 2k, 4k, 8k, 16k, 32k, 64k, 128k, 256k, 512k, 1m, 2m, 4m, 8m or 16m";
+
+  v->data = ngx_pnalloc(r->pool, NGX_INT64_LEN + 7);
+  if (v->data == NULL) {
+    return NGX_ERROR;
+  }
+
+  usec = *(uint64_t*)((u_char*)ctx + data);
+  v->len = ngx_sprintf(v->data, "%uL.%06uL", usec / 1000000, usec % 1000000) -
+           v->data;
+
+  return NGX_OK;
+}
+
+/* Reports encoder memory of the current worker; data is offset of counter in
+   ngx_http_brotli_worker_t. */
+static ngx_int_t ngx_http_brotli_worker_memory_variable(
+    ngx_http_request_t* r, ngx_http_variable_value_t* v, uintptr_t data) {
+  ngx_http_brotli_main_conf_t* mcf;
+  ngx_atomic_t* value;
+
+  mcf = ngx_http_get_module_main_conf(r, ngx_http_brotli_filter_module);
+  if (mcf->stats_sh == NULL || ngx_worker >= mcf->stats_sh->nworkers) {
+    v->not_found = 1;
+    return NGX_OK;
+  }
+
+  v->data = ngx_pnalloc(r->pool, NGX_ATOMIC_T_LEN);
+  if (v->data == NULL) {
+    return NGX_ERROR;
+  }
+
+  value = (ngx_atomic_t*)((u_char*)&mcf->stats_sh->workers[ngx_worker] + data);
+  v->len = ngx_sprintf(v->data, "%uA", *value) - v->data;
+  v->valid = 1;
+  v->no_cacheable = 0;
+  v->not_found = 0;
+
+  return NGX_OK;
+}
+
+static ngx_int_t ngx_http_brotli_flushes_variable(ngx_http_request_t* r,
+                                                  ngx_http_variable_value_t* v,
+                                                  uintptr_t data) {
+  ngx_http_brotli_ctx_t* ctx;
+
+  ctx = ngx_http_brotli_variable_ctx(r, v);
+  if (ctx == NULL) {
+    return NGX_OK;
+  }
+
+  v->data = ngx_pnalloc(r->pool, NGX_INT_T_LEN);
+  if (v->data == NULL) {
+    return NGX_ERROR;
+  }
+
+  v->len = ngx_sprintf(v->data, "%ui", ctx->flushes) - v->data;
+
+  return NGX_OK;
+}
+
+static ngx_uint_t ngx_http_brotli_skip_reason(ngx_http_request_t* r) {
+  ngx_http_brotli_conf_t* conf;
+  ngx_http_brotli_ctx_t* ctx;
+
+  ctx = ngx_http_get_module_ctx(r, ngx_http_brotli_filter_module);
+  if (ctx) {
+    return ctx->skip_reason;
+  }
+
+  /* Header filter does not record anything in disabled locations. */
+  conf = ngx_http_get_module_loc_conf(r, ngx_http_brotli_filter_module);
+
+  return conf->enable ? NGX_HTTP_BROTLI_SKIP_NONE
+                      : NGX_HTTP_BROTLI_SKIP_DISABLED;
+}
+
+static ngx_int_t ngx_http_brotli_skip_reason_variable(
+    ngx_http_request_t* r, ngx_http_variable_value_t* v, uintptr_t data) {
+  ngx_uint_t reason;
+
+  reason = ngx_http_brotli_skip_reason(r);
+  if (reason == NGX_HTTP_BROTLI_SKIP_NONE) {
+    v->not_found = 1;
+    return NGX_OK;
+  }
+
+  v->len = ngx_http_brotli_skip_reasons[reason].len;
+  v->data = ngx_http_brotli_skip_reasons[reason].data;
+  v->valid = 1;
+  v->no_cacheable = 0;
+  v->not_found = 0;
+
+  return NGX_OK;
+}
+
+static void* ngx_http_brotli_create_main_conf(ngx_conf_t* cf) {
+  ngx_http_brotli_main_conf_t* mcf;
+
+  mcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_brotli_main_conf_t));
+  if (mcf == NULL) {
+    return NULL;
+  }
+
+  if (ngx_array_init(&mcf->stats_keys, cf->pool, 4,
+                     sizeof(ngx_http_brotli_stats_key_t)) != NGX_OK) {
+    return NULL;
+  }
+
+  mcf->static_index = NGX_ERROR;
+
+  return mcf;
+}
+
+static void* ngx_http_brotli_create_conf(ngx_conf_t* cf) {
+  ngx_http_brotli_conf_t* conf;
+
+  conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_brotli_conf_t));
+  if (conf == NULL) {
+    return NULL;
+  }
+
+  /* ngx_pcalloc fills result with zeros ->
+       conf->bufs.num = 0;
+       conf->types = { NULL };
+       conf->types_keys = NULL; */
+
+  conf->enable = NGX_CONF_UNSET;
+
+  conf->quality = NGX_CONF_UNSET;
+  conf->lg_win = NGX_CONF_UNSET_SIZE;
+  conf->min_length = NGX_CONF_UNSET;
+  conf->lookahead = NGX_CONF_UNSET_SIZE;
+
+  conf->stats_server = NGX_CONF_UNSET_UINT;
+  conf->stats_location = NGX_CONF_UNSET_UINT;
+
+  conf->block_warn = NGX_CONF_UNSET_MSEC;
+
+  conf->size_levels = NGX_CONF_UNSET_PTR;
+
+  conf->tenant_quota = NGX_CONF_UNSET_MSEC;
+
+  return conf;
+}
+
+static char* ngx_http_brotli_merge_conf(ngx_conf_t* cf, void* parent,
+                                        void* child) {
+  ngx_http_brotli_conf_t* prev = parent;
+  ngx_http_brotli_conf_t* conf = child;
+  ngx_uint_t quality_set;
+  char* rc;
+
+  ngx_conf_merge_value(conf->enable, prev->enable, 0);
+
+  quality_set = (conf->quality != NGX_CONF_UNSET || conf->quality_value);
+
+  /* Values with variables are inherited with numbers they fall back to. */
+  if (conf->quality == NGX_CONF_UNSET && conf->quality_value == NULL) {
+    conf->quality_value = prev->quality_value;
+  }
+  if (conf->lg_win == NGX_CONF_UNSET_SIZE && conf->lg_win_value == NULL) {
+    conf->lg_win_value = prev->lg_win_value;
+  }
+
+  ngx_conf_merge_value(conf->quality, prev->quality, 6); /* Default quality 6 */
+
+  /* Size tiers are inherited with quality for unknown length, unless level
+     is set here: the nearest of the two directives applies. */
+  if (conf->size_levels == NGX_CONF_UNSET_PTR && !quality_set) {
+    conf->size_levels = prev->size_levels;
+    conf->size_unknown_level = prev->size_unknown_level;
+  }
+  if (conf->size_levels == NGX_CONF_UNSET_PTR) {
+    conf->size_levels = NULL;
+    conf->size_unknown_level = -1;
+  }
+  /* Default lg_win: Brotli default is 22. Nginx default was 19 (512k).
+     BrotliEncoderDEFAULT_WINDOW is 22.
+     Let's align with a common default or make it explicit.
+     The original code used 19 (512k).
+     BROTLI_DEFAULT_WINDOW is usually 22. Max is 24. Min is 10.
+  */
+  ngx_conf_merge_size_value(conf->lg_win, prev->lg_win, BROTLI_DEFAULT_WINDOW);
+  ngx_conf_merge_value(conf->min_length, prev->min_length, 20); /* Default min_length 20 bytes */
+  ngx_conf_merge_size_value(conf->lookahead, prev->lookahead, 0);
+  ngx_conf_merge_msec_value(conf->block_warn, prev->block_warn, 0);
+
+  if (conf->tenant == NULL) {
+    conf->tenant = prev->tenant;
+  }
+
+  /* Quota parameters are inherited together. */
+  if (conf->tenant_quota == NGX_CONF_UNSET_MSEC) {
+    conf->tenant_quota = prev->tenant_quota;
+    conf->tenant_window = prev->tenant_window;
+    conf->tenant_degrade = prev->tenant_degrade;
+  }
+  if (conf->tenant_quota == NGX_CONF_UNSET_MSEC) {
+    conf->tenant_quota = 0;
+  }
+
+  if (ngx_http_brotli_merge_tenant(cf, conf) != NGX_CONF_OK) {
+    return NGX_CONF_ERROR;
+  }
+
+  rc = ngx_http_merge_types(cf, &conf->types_keys, &conf->types,
+                            &prev->types_keys, &prev->types,
+                            ngx_http_html_default_types);
+  if (rc != NGX_CONF_OK) {
+    return NGX_CONF_ERROR;
+  }
+
+  return ngx_http_brotli_merge_stats(cf, prev, conf);
+}
+
+/* Prepend to filter chain. */
+static ngx_int_t ngx_http_brotli_filter_init(ngx_conf_t* cf) {
+  ngx_http_brotli_main_conf_t* mcf;
+  ngx_http_core_main_conf_t* cmcf;
+  ngx_http_variable_t* v;
+  ngx_http_variable_t* bv;
+  ngx_http_handler_pt* h;
+  ngx_uint_t i;
+
+  mcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_brotli_filter_module);
+
+  if (mcf->status && mcf->stats_zone == NULL) {
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "\"brotli_status\" requires \"brotli_stats_zone\"");
+    return NGX_ERROR;
+  }
+
+  if (mcf->stats_zone) {
+    mcf->ccf =
+        (ngx_core_conf_t*)ngx_get_conf(cf->cycle->conf_ctx, ngx_core_module);
+
+    /* Locations are merged at this point, so all the nodes are known. */
+    mcf->stats_nodes =
+        ngx_pcalloc(cf->pool, (mcf->stats_keys.nelts + 1) *
+                                  sizeof(ngx_http_brotli_stats_node_t*));
+    if (mcf->stats_nodes == NULL) {
+      return NGX_ERROR;
+    }
+
+    /* Static module reports its lookups via variable; it is optional. */
+    for (i = 0; cf->cycle->modules[i]; i++) {
+      if (ngx_strcmp(cf->cycle->modules[i]->name,
+                     ngx_http_brotli_static_module_name.data) == 0) {
+        mcf->static_index =
+            ngx_http_get_variable_index(cf, &ngx_http_brotli_static_var);
+        if (mcf->static_index == NGX_ERROR) {
+          return NGX_ERROR;
+        }
+        break;
+      }
+    }
+
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+    h = ngx_array_push(&cmcf->phases[NGX_HTTP_LOG_PHASE].handlers);
+    if (h == NULL) {
+      return NGX_ERROR;
+    }
+    *h = ngx_http_brotli_stats_log_handler;
+  }
+
+  if (mcf->event_log) {
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+    h = ngx_array_push(&cmcf->phases[NGX_HTTP_LOG_PHASE].handlers);
+    if (h == NULL) {
+      return NGX_ERROR;
+    }
+    *h = ngx_http_brotli_event_log_handler;
+  }
+
+  /* Variables used in configuration (log formats, maps) are indexed by now,
+     though not yet bound to handlers; locations that limit or warn on time
+     are timed regardless. */
+  mcf->timing = mcf->stats_zone || mcf->event_log;
+  cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+  v = cmcf->variables.elts;
+  for (i = 0; !mcf->timing && i < cmcf->variables.nelts; i++) {
+    for (bv = ngx_http_brotli_vars; bv->name.len; bv++) {
+      if (bv->get_handler == ngx_http_brotli_time_variable &&
+          bv->name.len == v[i].name.len &&
+          ngx_strncmp(bv->name.data, v[i].name.data, bv->name.len) == 0) {
+        mcf->timing = 1;
+      }
+    }
+  }
+
+  for (i = 0; i < NGX_HTTP_BROTLI_SKIP_N; i++) {
+    ngx_http_brotli_skipped[i].closed = 1;
+    ngx_http_brotli_skipped[i].skip_reason = i;
+  }
+
+  ngx_http_next_header_filter = ngx_http_top_header_filter;
+  ngx_http_top_header_filter = ngx_http_brotli_header_filter;
+
+  ngx_http_next_body_filter = ngx_http_top_body_filter;
+  ngx_http_top_body_filter = ngx_http_brotli_body_filter;
+
+  return NGX_OK;
+}
+
+/* Translate "window size" to window bits (log2), and check bounds. */
+static char* ngx_http_brotli_parse_wbits(ngx_conf_t* cf, void* post,
+                                         void* data) {
+  size_t* parameter = data; /* This is where lg_win (which is actually size in bytes) is stored by ngx_conf_set_size_slot */
+  size_t wsize_bytes = *parameter;
+  size_t bits;
+
+  /* Find the closest power of 2 for window bits that matches the size */
+  for (bits = BROTLI_MIN_WINDOW_BITS; bits <= BROTLI_MAX_WINDOW_BITS; bits++) {
+    if (wsize_bytes == (1u << bits)) {
+      *parameter = bits; /* Store the bits value */
+      return NGX_CONF_OK;
+    }
+  }
+  
+  /* If an exact power-of-2 match isn't found from the typical list */
+  ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid brotli_window value \"%uz\", must be a power of 2 between 1k (for 10 bits) and 16m (for 24 bits)", wsize_bytes);
+  return "must be 1k, 2k, 4k, 8k, 16k, 32k, 64k, 128k, 256k, 512k, 1m, 2m, 4m, 8m or 16m";
+}
+
+/* Compiles directive argument with variables into *cv. */
+static char* ngx_http_brotli_conf_value(ngx_conf_t* cf,
+                                        ngx_http_complex_value_t** cv) {
+  ngx_http_compile_complex_value_t ccv;
+  ngx_str_t* value;
+
+  value = cf->args->elts;
+
+  *cv = ngx_palloc(cf->pool, sizeof(ngx_http_complex_value_t));
+  if (*cv == NULL) {
+    return NGX_CONF_ERROR;
+  }
+
+  ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+  ccv.cf = cf;
+  ccv.value = &value[1];
+  ccv.complex_value = *cv;
+
+  if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+    return NGX_CONF_ERROR;
+  }
+
+  return NGX_CONF_OK;
+}
+
+/* Number, or value with variables that is evaluated per response. */
+static char* ngx_http_brotli_comp_level(ngx_conf_t* cf, ngx_command_t* cmd,
+                                        void* conf) {
+  ngx_http_brotli_conf_t* bcf = conf;
+  ngx_str_t* value;
+
+  if (bcf->quality_value) {
+    return "is duplicate";
+  }
+
+  value = cf->args->elts;
+
+  if (ngx_http_script_variables_count(&value[1]) == 0) {
+    return ngx_conf_set_num_slot(cf, cmd, conf);
+  }
+
+  if (bcf->quality != NGX_CONF_UNSET) {
+    return "is duplicate";
+  }
+
+  return ngx_http_brotli_conf_value(cf, &bcf->quality_value);
+}
+
+/* Size, or value with variables that is evaluated per response. */
+static char* ngx_http_brotli_window(ngx_conf_t* cf, ngx_command_t* cmd,
+                                    void* conf) {
+  ngx_http_brotli_conf_t* bcf = conf;
+  ngx_str_t* value;
+
+  if (bcf->lg_win_value) {
+    return "is duplicate";
+  }
+
+  value = cf->args->elts;
+
+  if (ngx_http_script_variables_count(&value[1]) == 0) {
+    return ngx_conf_set_size_slot(cf, cmd, conf);
+  }
+
+  if (bcf->lg_win != NGX_CONF_UNSET_SIZE) {
+    return "is duplicate";
+  }
+
+  return ngx_http_brotli_conf_value(cf, &bcf->lg_win_value);
+}
+
+/* "<min>-[<max>]:<level>"... [unknown=<level>] | off */
+static char* ngx_http_brotli_comp_level_by_size(ngx_conf_t* cf,
+                                                ngx_command_t* cmd,
+                                                void* conf) {
+  ngx_http_brotli_conf_t* bcf = conf;
+  ngx_http_brotli_size_level_t* sl;
+  ngx_str_t* value;
+  ngx_str_t s;
+  ngx_uint_t i;
+  ngx_int_t n;
+  u_char* colon;
+  u_char* dash;
+  u_char* end;
+
+  if (bcf->size_levels != NGX_CONF_UNSET_PTR) {
+    return "is duplicate";
+  }
+
+  value = cf->args->elts;
+
+  bcf->size_levels = NULL;
+  bcf->size_unknown_level = -1;
+
+  if (ngx_strcmp(value[1].data, "off") == 0) {
+    if (cf->args->nelts != 2) {
+      return "has invalid parameters after \"off\"";
+    }
+    return NGX_CONF_OK;
+  }
+
+  bcf->size_levels =
+      ngx_array_create(cf->pool, 4, sizeof(ngx_http_brotli_size_level_t));
+  if (bcf->size_levels == NULL) {
+    return NGX_CONF_ERROR;
+  }
+
+  for (i = 1; i < cf->args->nelts; i++) {
+    end = value[i].data + value[i].len;
+
+    if (ngx_strncmp(value[i].data, "unknown=", 8) == 0) {
+      n = ngx_atoi(value[i].data + 8, value[i].len - 8);
+      if (n < BROTLI_MIN_QUALITY || n > BROTLI_MAX_QUALITY) {
+        goto invalid;
+      }
+      bcf->size_unknown_level = n;
+      continue;
+    }
+
+    colon = ngx_strlchr(value[i].data, end, ':');
+    dash = colon ? ngx_strlchr(value[i].data, colon, '-') : NULL;
+    if (dash == NULL) {
+      goto invalid;
+    }
+
+    sl = ngx_array_push(bcf->size_levels);
+    if (sl == NULL) {
+      return NGX_CONF_ERROR;
+    }
+
+    s.data = value[i].data;
+    s.len = dash - s.data;
+    sl->min = ngx_parse_offset(&s);
+
+    s.data = dash + 1;
+    s.len = colon - s.data;
+    sl->max = s.len ? ngx_parse_offset(&s) : NGX_MAX_OFF_T_VALUE;
+
+    sl->quality = ngx_atoi(colon + 1, end - colon - 1);
+
+    if (sl->min == NGX_ERROR || sl->max == NGX_ERROR || sl->min >= sl->max ||
+        sl->quality < BROTLI_MIN_QUALITY || sl->quality > BROTLI_MAX_QUALITY) {
+      goto invalid;
+    }
+  }
+
+  return NGX_CONF_OK;
+
+invalid:
+
+  ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid parameter \"%V\"",
+                     &value[i]);
+
+  return NGX_CONF_ERROR;
+}
+
+static char* ngx_http_brotli_stats_zone(ngx_conf_t* cf, ngx_command_t* cmd,
+                                        void* conf) {
+  ngx_http_brotli_main_conf_t* mcf = conf;
+  ngx_str_t* value;
+  ngx_str_t name;
+  ngx_str_t s;
+  u_char* p;
+  ssize_t size;
+
+  if (mcf->stats_zone) {
+    return "is duplicate";
+  }
+
+  value = cf->args->elts;
+
+  p = (u_char*)ngx_strchr(value[1].data, ':');
+  if (p == NULL) {
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid zone \"%V\"", &value[1]);
+    return NGX_CONF_ERROR;
+  }
+
+  name.data = value[1].data;
+  name.len = p - value[1].data;
+
+  s.data = p + 1;
+  s.len = value[1].data + value[1].len - s.data;
+
+  size = ngx_parse_size(&s);
+  if (name.len == 0 || size == NGX_ERROR) {
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid zone \"%V\"", &value[1]);
+    return NGX_CONF_ERROR;
+  }
+
+  if (size < (ssize_t)(8 * ngx_pagesize)) {
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "zone \"%V\" is too small",
+                       &value[1]);
+    return NGX_CONF_ERROR;
+  }
+
+  mcf->stats_zone =
+      ngx_shared_memory_add(cf, &name, size, &ngx_http_brotli_filter_module);
+  if (mcf->stats_zone == NULL) {
+    return NGX_CONF_ERROR;
+  }
+
+  if (mcf->stats_zone->data) {
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "duplicate zone \"%V\"", &name);
+    return NGX_CONF_ERROR;
+  }
+
+  mcf->stats_zone->init = ngx_http_brotli_stats_init_zone;
+  mcf->stats_zone->data = mcf;
+
+  return NGX_CONF_OK;
+}
+
+static char* ngx_http_brotli_status(ngx_conf_t* cf, ngx_command_t* cmd,
+                                    void* conf) {
+  ngx_http_brotli_main_conf_t* mcf;
+  ngx_http_core_loc_conf_t* clcf;
+
+  mcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_brotli_filter_module);
+  mcf->status = 1;
+
+  clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+  clcf->handler = ngx_http_brotli_status_handler;
+
+  return NGX_CONF_OK;
+}
+
+static char* ngx_http_brotli_tenant_quota(ngx_conf_t* cf, ngx_command_t* cmd,
+                                          void* conf) {
+  ngx_http_brotli_conf_t* bcf = conf;
+  ngx_str_t* value;
+  ngx_str_t s;
+  ngx_uint_t i;
+  ngx_int_t n;
+
+  if (bcf->tenant_quota != NGX_CONF_UNSET_MSEC) {
+    return "is duplicate";
+  }
+
+  value = cf->args->elts;
+
+  bcf->tenant_window = 60;
+  bcf->tenant_degrade = -1;
+
+  if (ngx_strcmp(value[1].data, "off") == 0) {
+    if (cf->args->nelts != 2) {
+      return "has invalid parameters after \"off\"";
+    }
+    bcf->tenant_quota = 0;
+    return NGX_CONF_OK;
+  }
+
+  n = ngx_parse_time(&value[1], 0);
+  if (n == NGX_ERROR || n == 0) {
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid quota \"%V\"",
+                       &value[1]);
+    return NGX_CONF_ERROR;
+  }
+  bcf->tenant_quota = (ngx_msec_t)n;
+
+  for (i = 2; i < cf->args->nelts; i++) {
+    if (ngx_strncmp(value[i].data, "window=", 7) == 0) {
+      s.len = value[i].len - 7;
+      s.data = value[i].data + 7;
+
+      n = ngx_parse_time(&s, 1);
+      if (n == NGX_ERROR || n == 0) {
+        goto invalid;
+      }
+      bcf->tenant_window = (time_t)n;
+      continue;
+    }
+
+    if (ngx_strncmp(value[i].data, "degrade=", 8) == 0) {
+      s.len = value[i].len - 8;
+      s.data = value[i].data + 8;
+
+      n = ngx_atoi(s.data, s.len);
+      if (n < BROTLI_MIN_QUALITY || n > BROTLI_MAX_QUALITY) {
+        goto invalid;
+      }
+      bcf->tenant_degrade = n;
+      continue;
+    }
+
+    goto invalid;
+  }
+
+  return NGX_CONF_OK;
+
+invalid:
+
+  ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid parameter \"%V\"",
+                     &value[i]);
+
+  return NGX_CONF_ERROR;
+}
+
+/* Tenants are accounted in statistics zone; with quota alone, server is
+   the tenant. */
+static char* ngx_http_brotli_merge_tenant(ngx_conf_t* cf,
+                                          ngx_http_brotli_conf_t* conf) {
+  ngx_http_brotli_main_conf_t* mcf;
+  ngx_http_compile_complex_value_t ccv;
+  ngx_str_t server_name = ngx_string("$server_name");
+
+  if (conf->tenant == NULL && conf->tenant_quota == 0) {
+    return NGX_CONF_OK;
+  }
+
+  mcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_brotli_filter_module);
+  if (mcf->stats_zone == NULL) {
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "\"brotli_tenant\" and \"brotli_tenant_quota\" "
+                       "require \"brotli_stats_zone\"");
+    return NGX_CONF_ERROR;
+  }
+
+  if (conf->tenant) {
+    return NGX_CONF_OK;
+  }
+
+  conf->tenant = ngx_palloc(cf->pool, sizeof(ngx_http_complex_value_t));
+  if (conf->tenant == NULL) {
+    return NGX_CONF_ERROR;
+  }
+
+  ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+  ccv.cf = cf;
+  ccv.value = &server_name;
+  ccv.complex_value = conf->tenant;
+
+  if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+    return NGX_CONF_ERROR;
+  }
+
+  return NGX_CONF_OK;
+}
+
+static char* ngx_http_brotli_event_log(ngx_conf_t* cf, ngx_command_t* cmd,
+                                       void* conf) {
+  ngx_http_brotli_main_conf_t* mcf = conf;
+  ngx_http_brotli_event_log_t* log;
+  ngx_str_t* value;
+  ngx_str_t s;
+  ngx_uint_t i;
+  ngx_int_t sample;
+  ngx_int_t quality;
+  ssize_t size;
+  ngx_msec_t flush;
+
+  if (mcf->event_log) {
+    return "is duplicate";
+  }
+
+  value = cf->args->elts;
+
+  if (ngx_strcmp(value[1].data, "off") == 0) {
+    if (cf->args->nelts != 2) {
+      return "has invalid parameters after \"off\"";
+    }
+    return NGX_CONF_OK;
+  }
+
+  sample = 1;
+  size = 64 * 1024;
+  flush = 1000;
+  quality = -1;
+
+  for (i = 2; i < cf->args->nelts; i++) {
+    if (ngx_strncmp(value[i].data, "sample=", 7) == 0) {
+      sample = ngx_atoi(value[i].data + 7, value[i].len - 7);
+      if (sample == NGX_ERROR || sample == 0) {
+        goto invalid;
+      }
+      continue;
+    }
+
+    if (ngx_strncmp(value[i].data, "buffer=", 7) == 0) {
+      s.len = value[i].len - 7;
+      s.data = value[i].data + 7;
+      size = ngx_parse_size(&s);
+      if (size == NGX_ERROR || size < 4096) {
+        goto invalid;
+      }
+      continue;
+    }
+
+    if (ngx_strncmp(value[i].data, "flush=", 6) == 0) {
+      s.len = value[i].len - 6;
+      s.data = value[i].data + 6;
+      flush = ngx_parse_time(&s, 0);
+      if (flush == (ngx_msec_t)NGX_ERROR || flush == 0) {
+        goto invalid;
+      }
+      continue;
+    }
+
+    if (ngx_strcmp(value[i].data, "brotli") == 0) {
+      quality = 4;
+      continue;
+    }
+
+    if (ngx_strncmp(value[i].data, "brotli=", 7) == 0) {
+      quality = ngx_atoi(value[i].data + 7, value[i].len - 7);
+      if (quality == NGX_ERROR || quality > BROTLI_MAX_QUALITY) {
+        goto invalid;
+      }
+      continue;
+    }
+
+    goto invalid;
+  }
+
+  log = ngx_pcalloc(cf->pool, sizeof(ngx_http_brotli_event_log_t));
+  if (log == NULL) {
+    return NGX_CONF_ERROR;
+  }
+
+  log->file = ngx_conf_open_file(cf->cycle, &value[1]);
+  if (log->file == NULL) {
+    return NGX_CONF_ERROR;
+  }
+
+  if (log->file->data) {
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "file \"%V\" is already in use",
+                       &value[1]);
+    return NGX_CONF_ERROR;
+  }
+
+  log->start = ngx_pnalloc(cf->pool, size);
+  if (log->start == NULL) {
+    return NGX_CONF_ERROR;
+  }
+  log->pos = log->start;
+  log->last = log->start + size;
+
+  log->quality = quality;
+  if (quality != -1) {
+    log->out_size = BrotliEncoderMaxCompressedSize(size);
+    log->out = ngx_pnalloc(cf->pool, log->out_size);
+    if (log->out == NULL) {
+      return NGX_CONF_ERROR;
+    }
+  }
+
+  log->event = ngx_pcalloc(cf->pool, sizeof(ngx_event_t));
+  if (log->event == NULL) {
+    return NGX_CONF_ERROR;
+  }
+  log->event->data = log;
+  log->event->handler = ngx_http_brotli_event_log_flush_handler;
+  log->event->log = &cf->cycle->new_log;
+  log->event->cancelable = 1;
+
+  log->flush = flush;
+  log->sample = sample;
+
+  /* Reopening and exiting worker flushes the buffer. */
+  log->file->flush = ngx_http_brotli_event_log_flush;
+  log->file->data = log;
+
+  mcf->event_log = log;
+
+  return NGX_CONF_OK;
+
+invalid:
+
+  ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid parameter \"%V\"",
+                     &value[i]);
+  return NGX_CONF_ERROR;
+}
+
+/* Escapes Prometheus label value: backslash, double quote and line feed.
+   Returns number of added bytes, if dst is NULL, like ngx_escape_json(). */
+static uintptr_t ngx_http_brotli_escape_prometheus(u_char* dst, u_char* src,
+                                                   size_t size) {
+  ngx_uint_t n;
+
+  if (dst == NULL) {
+    n = 0;
+    while (size--) {
+      if (*src == '\\' || *src == '"' || *src == '\n') {
+        n++;
+      }
+      src++;
+    }
+
+    return (uintptr_t)n;
+  }
+
+  while (size--) {
+    switch (*src) {
+      case '\\':
+      case '"':
+        *dst++ = '\\';
+        *dst++ = *src;
+        break;
+      case '\n':
+        *dst++ = '\\';
+        *dst++ = 'n';
+        break;
+      default:
+        *dst++ = *src;
+    }
+    src++;
+  }
+
+  return (uintptr_t)dst;
+}
+
+/* Copies string to pool, escaping it on the way. */
+static ngx_int_t ngx_http_brotli_stats_escape(ngx_conf_t* cf, ngx_str_t* dst,
+                                              ngx_str_t* src,
+                                              ngx_http_brotli_escape_pt escape) {
+  size_t len;
+
+  len = src->len + escape(NULL, src->data, src->len);
+
+  dst->data = ngx_pnalloc(cf->pool, len);
+  if (dst->data == NULL) {
+    return NGX_ERROR;
+  }
+
+  dst->len = len;
+  escape(dst->data, src->data, src->len);
+
+  return NGX_OK;
+}
+
+/* Finds or registers statistics node of server / location; returns its index
+   in stats_keys, or NGX_CONF_UNSET_UINT on error. */
+static ngx_uint_t ngx_http_brotli_stats_key(ngx_conf_t* cf,
+                                            ngx_http_brotli_main_conf_t* mcf,
+                                            ngx_str_t* server,
+                                            ngx_str_t* location) {
+  ngx_http_brotli_stats_key_t* keys;
+  ngx_http_brotli_stats_key_t* key;
+  ngx_str_t k;
+  ngx_uint_t i;
+
+  /* Server names have no spaces, so "<kind><server> <location>" is unique. */
+  k.len = 1 + server->len + (location ? 1 + location->len : 0);
+  k.data = ngx_pnalloc(cf->pool, k.len);
+  if (k.data == NULL) {
+    return NGX_CONF_UNSET_UINT;
+  }
+
+  if (location) {
+    ngx_sprintf(k.data, "l%V %V", server, location);
+  } else {
+    ngx_sprintf(k.data, "s%V", server);
+  }
+
+  keys = mcf->stats_keys.elts;
+  for (i = 0; i < mcf->stats_keys.nelts; i++) {
+    if (keys[i].key.len == k.len &&
+        ngx_memcmp(keys[i].key.data, k.data, k.len) == 0) {
+      return i;
+    }
+  }
+
+  key = ngx_array_push(&mcf->stats_keys);
+  if (key == NULL) {
+    return NGX_CONF_UNSET_UINT;
+  }
+
+  ngx_memzero(key, sizeof(ngx_http_brotli_stats_key_t));
+  key->key = k;
+  key->is_location = location ? 1 : 0;
+
+  if (ngx_http_brotli_stats_escape(cf, &key->server, server,
+                                   ngx_escape_json) != NGX_OK ||
+      ngx_http_brotli_stats_escape(cf, &key->server_label, server,
+                                   ngx_http_brotli_escape_prometheus) !=
+          NGX_OK) {
+    return NGX_CONF_UNSET_UINT;
+  }
+
+  if (location &&
+      (ngx_http_brotli_stats_escape(cf, &key->location, location,
+                                    ngx_escape_json) != NGX_OK ||
+       ngx_http_brotli_stats_escape(cf, &key->location_label, location,
+                                    ngx_http_brotli_escape_prometheus) !=
+           NGX_OK)) {
+    return NGX_CONF_UNSET_UINT;
+  }
+
+  return mcf->stats_keys.nelts - 1;
+}
+
+/* Assigns statistics nodes: server{} level configuration gets node of the
+   server, named locations get their own nodes, and implicit ones ("if",
+   "limit_except") account to their parents. */
+static char* ngx_http_brotli_merge_stats(ngx_conf_t* cf,
+                                         ngx_http_brotli_conf_t* prev,
+                                         ngx_http_brotli_conf_t* conf) {
+  ngx_http_brotli_main_conf_t* mcf;
+  ngx_http_core_srv_conf_t* cscf;
+  ngx_http_core_loc_conf_t* clcf;
+  ngx_str_t server;
+
+  mcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_brotli_filter_module);
+  if (mcf->stats_zone == NULL) {
+    return NGX_CONF_OK;
+  }
+
+  cscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_core_module);
+  clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+
+  if (clcf->noname) {
+    conf->stats_server = prev->stats_server;
+    conf->stats_location = prev->stats_location;
+    return NGX_CONF_OK;
+  }
+
+  server = cscf->server_name;
+  if (server.len == 0) {
+    ngx_str_set(&server, "_");
+  }
+
+  if (clcf->name.len == 0) {
+    conf->stats_server = ngx_http_brotli_stats_key(cf, mcf, &server, NULL);
+    conf->stats_location = NGX_HTTP_BROTLI_STATS_NONE;
+    return conf->stats_server == NGX_CONF_UNSET_UINT ? NGX_CONF_ERROR
+                                                     : NGX_CONF_OK;
+  }
+
+  conf->stats_server = prev->stats_server;
+  conf->stats_location =
+      ngx_http_brotli_stats_key(cf, mcf, &server, &clcf->name);
+
+  return conf->stats_location == NGX_CONF_UNSET_UINT ? NGX_CONF_ERROR
+                                                     : NGX_CONF_OK;
+}
+
+/* Orders histogram nodes by hash, then by key and MIME type. */
+static void ngx_http_brotli_hist_rbtree_insert_value(
+    ngx_rbtree_node_t* temp, ngx_rbtree_node_t* node,
+    ngx_rbtree_node_t* sentinel) {
+  ngx_http_brotli_hist_node_t* hn;
+  ngx_http_brotli_hist_node_t* hnt;
+  ngx_rbtree_node_t** p;
+  ngx_int_t rc;
+
+  for (;;) {
+    if (node->key != temp->key) {
+      p = (node->key < temp->key) ? &temp->left : &temp->right;
+    } else {
+      hn = (ngx_http_brotli_hist_node_t*)node;
+      hnt = (ngx_http_brotli_hist_node_t*)temp;
+
+      rc = (ngx_int_t)hn->key_len - (ngx_int_t)hnt->key_len;
+      if (rc == 0) {
+        rc = (ngx_int_t)hn->type_len - (ngx_int_t)hnt->type_len;
+      }
+      if (rc == 0) {
+        rc = ngx_memcmp(hn->data, hnt->data, hn->key_len + hn->type_len);
+      }
+
+      p = (rc < 0) ? &temp->left : &temp->right;
+    }
+
+    if (*p == sentinel) {
+      break;
+    }
+
+    temp = *p;
+  }
+
+  *p = node;
+  node->parent = temp;
+  node->left = sentinel;
+  node->right = sentinel;
+  ngx_rbt_red(node);
+}
+
+static ngx_int_t ngx_http_brotli_stats_init_zone(ngx_shm_zone_t* shm_zone,
+                                                 void* data) {
+  ngx_http_brotli_main_conf_t* omcf = data;
+  ngx_http_brotli_main_conf_t* mcf;
+  ngx_http_brotli_stats_key_t* keys;
+  ngx_http_brotli_stats_node_t* node;
+  ngx_http_brotli_worker_t* workers;
+  ngx_slab_pool_t* shpool;
+  ngx_uint_t i;
+  size_t len;
+
+  mcf = shm_zone->data;
+  shpool = (ngx_slab_pool_t*)shm_zone->shm.addr;
+  mcf->stats_shpool = shpool;
+
+  if (omcf) {
+    mcf->stats_sh = omcf->stats_sh;
+
+  } else if (shm_zone->shm.exists) {
+    mcf->stats_sh = shpool->data;
+
+  } else {
+    mcf->stats_sh = ngx_slab_calloc(shpool, sizeof(ngx_http_brotli_stats_sh_t));
+    if (mcf->stats_sh == NULL) {
+      return NGX_ERROR;
+    }
+
+    ngx_rbtree_init(&mcf->stats_sh->hist_rbtree, &mcf->stats_sh->hist_sentinel,
+                    ngx_http_brotli_hist_rbtree_insert_value);
+    ngx_rbtree_init(&mcf->stats_sh->tenant_rbtree,
+                    &mcf->stats_sh->tenant_sentinel,
+                    ngx_str_rbtree_insert_value);
+    shpool->data = mcf->stats_sh;
+
+    len = sizeof(" in brotli_stats_zone \"\"") + shm_zone->shm.name.len;
+    shpool->log_ctx = ngx_slab_alloc(shpool, len);
+    if (shpool->log_ctx == NULL) {
+      return NGX_ERROR;
+    }
+    ngx_sprintf(shpool->log_ctx, " in brotli_stats_zone \"%V\"%Z",
+                &shm_zone->shm.name);
+  }
+
+  /* Workers of previous cycle may still account in old slots, so these are
+     kept when number of workers grows. */
+  if (mcf->stats_sh->nworkers < (ngx_uint_t)mcf->ccf->worker_processes) {
+    workers = ngx_slab_calloc(shpool, mcf->ccf->worker_processes *
+                                          sizeof(ngx_http_brotli_worker_t));
+    if (workers == NULL) {
+      ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                    "brotli_stats_zone \"%V\" is too small for %i workers",
+                    &shm_zone->shm.name, mcf->ccf->worker_processes);
+      return NGX_ERROR;
+    }
+
+    mcf->stats_sh->workers = workers;
+    mcf->stats_sh->nworkers = mcf->ccf->worker_processes;
+  }
+
+  /* Reuse nodes that survived reload, so counters keep growing. */
+  keys = mcf->stats_keys.elts;
+  for (i = 0; i < mcf->stats_keys.nelts; i++) {
+    for (node = mcf->stats_sh->nodes; node; node = node->next) {
+      if (node->len == keys[i].key.len &&
+          ngx_memcmp(node->key, keys[i].key.data, node->len) == 0) {
+        break;
+      }
+    }
+
+    if (node == NULL) {
+      node = ngx_slab_alloc(shpool, offsetof(ngx_http_brotli_stats_node_t, key) +
+                                        keys[i].key.len);
+      if (node == NULL) {
+        ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                      "brotli_stats_zone \"%V\" is too small for %ui nodes",
+                      &shm_zone->shm.name, mcf->stats_keys.nelts);
+        return NGX_ERROR;
+      }
+
+      ngx_memzero(&node->counters, sizeof(ngx_http_brotli_stats_counters_t));
+      node->len = keys[i].key.len;
+      ngx_memcpy(node->key, keys[i].key.data, node->len);
+
+      node->next = mcf->stats_sh->nodes;
+      mcf->stats_sh->nodes = node;
+    }
+
+    mcf->stats_nodes[i] = node;
+  }
+
+  return NGX_OK;
+}
+
+static void ngx_http_brotli_stats_update(ngx_http_brotli_stats_node_t* node,
+                                         ngx_http_brotli_ctx_t* ctx,
+                                         ngx_uint_t skipped,
+                                         ngx_uint_t reason, off_t bytes,
+                                         ngx_uint_t static_hit,
+                                         ngx_uint_t static_miss) {
+  ngx_http_brotli_stats_counters_t* c = &node->counters;
+
+  if (ctx) {
+    (void)ngx_atomic_fetch_add(&c->compressed, 1);
+    (void)ngx_atomic_fetch_add(&c->bytes_in, ctx->bytes_in);
+    (void)ngx_atomic_fetch_add(&c->bytes_out, ctx->bytes_out);
+    (void)ngx_atomic_fetch_add(&c->encoder_usec, ctx->encoder_usec);
+    if (ctx->closed && !ctx->success) {
+      (void)ngx_atomic_fetch_add(&c->errors, 1);
+    }
+  }
+
+  if (skipped) {
+    (void)ngx_atomic_fetch_add(&c->skipped, 1);
+  }
+
+  if (reason != NGX_HTTP_BROTLI_SKIP_NONE) {
+    (void)ngx_atomic_fetch_add(&c->skip_responses[reason], 1);
+    (void)ngx_atomic_fetch_add(&c->skip_bytes[reason], bytes);
+  }
+
+  if (static_hit) {
+    (void)ngx_atomic_fetch_add(&c->static_hits, 1);
+  } else if (static_miss) {
+    (void)ngx_atomic_fetch_add(&c->static_misses, 1);
+  }
+}
+
+/* Returns index of histogram bucket of value. */
+static ngx_uint_t ngx_http_brotli_hist_bucket(uint64_t value) {
+  ngx_uint_t msb;
+  ngx_uint_t i;
+
+  if (value < 4) {
+    return (ngx_uint_t)value;
+  }
+
+  for (msb = 2; (value >> (msb + 1)) != 0; msb++) {
+    /* void */
+  }
+
+  i = (msb - 1) * 4 + (ngx_uint_t)((value >> (msb - 2)) & 3);
+
+  return ngx_min(i, NGX_HTTP_BROTLI_HIST_BUCKETS - 1);
+}
+
+/* Returns the largest value that falls into bucket. */
+static uint64_t ngx_http_brotli_hist_bucket_bound(ngx_uint_t i) {
+  ngx_uint_t msb;
+
+  if (i < 4) {
+    return i;
+  }
+
+  msb = i / 4 + 1;
+
+  return ((uint64_t)1 << msb) + ((uint64_t)(i % 4) << (msb - 2)) +
+         ((uint64_t)1 << (msb - 2)) - 1;
+}
+
+static void ngx_http_brotli_hist_add(ngx_http_brotli_hist_t* hist,
+                                     uint64_t value) {
+  (void)ngx_atomic_fetch_add(&hist->count, 1);
+  (void)ngx_atomic_fetch_add(&hist->sum, (ngx_atomic_uint_t)value);
+  (void)ngx_atomic_fetch_add(&hist->buckets[ngx_http_brotli_hist_bucket(value)],
+                             1);
+}
+
+/* Finds or creates histogram node of statistics node and MIME type;
+   should be called with zone locked. */
+static ngx_http_brotli_hist_node_t* ngx_http_brotli_hist_lookup(
+    ngx_http_brotli_main_conf_t* mcf, ngx_str_t* key, ngx_str_t* type,
+    uint32_t hash) {
+  ngx_http_brotli_hist_node_t* hn;
+  ngx_rbtree_node_t* node;
+  ngx_rbtree_node_t* sentinel;
+  ngx_int_t rc;
+
+  node = mcf->stats_sh->hist_rbtree.root;
+  sentinel = mcf->stats_sh->hist_rbtree.sentinel;
+
+  while (node != sentinel) {
+    if (hash != node->key) {
+      node = (hash < node->key) ? node->left : node->right;
+      continue;
+    }
+
+    hn = (ngx_http_brotli_hist_node_t*)node;
+
+    rc = (ngx_int_t)key->len - (ngx_int_t)hn->key_len;
+    if (rc == 0) {
+      rc = (ngx_int_t)type->len - (ngx_int_t)hn->type_len;
+    }
+    if (rc == 0) {
+      rc = ngx_memcmp(key->data, hn->data, key->len);
+    }
+    if (rc == 0) {
+      rc = ngx_memcmp(type->data, hn->data + key->len, type->len);
+    }
+    if (rc == 0) {
+      return hn;
+    }
+
+    node = (rc < 0) ? node->left : node->right;
+  }
+
+  hn = ngx_slab_alloc_locked(
+      mcf->stats_shpool,
+      offsetof(ngx_http_brotli_hist_node_t, data) + key->len + type->len);
+  if (hn == NULL) {
+    return NULL;
+  }
+
+  ngx_memzero(hn, offsetof(ngx_http_brotli_hist_node_t, data));
+  hn->node.key = hash;
+  hn->key_len = key->len;
+  hn->type_len = type->len;
+  ngx_memcpy(hn->data, key->data, key->len);
+  ngx_memcpy(hn->data + key->len, type->data, type->len);
+
+  ngx_rbtree_insert(&mcf->stats_sh->hist_rbtree, &hn->node);
+
+  /* Node must be complete before it is visible to status handler. */
+  hn->next = mcf->stats_sh->hist;
+  ngx_memory_barrier();
+  mcf->stats_sh->hist = hn;
+
+  return hn;
+}
+
+/* Accounts successfully compressed response in histograms. */
+static void ngx_http_brotli_hist_update(ngx_http_request_t* r,
+                                        ngx_http_brotli_main_conf_t* mcf,
+                                        ngx_http_brotli_conf_t* conf,
+                                        ngx_http_brotli_ctx_t* ctx) {
+  ngx_http_brotli_stats_key_t* keys;
+  ngx_http_brotli_hist_node_t** cached;
+  ngx_http_brotli_hist_node_t* hn;
+  ngx_uint_t index;
+  ngx_str_t type;
+  u_char lowcase[NGX_HTTP_BROTLI_HIST_TYPE_LEN];
+  uint32_t hash;
+
+  keys = mcf->stats_keys.elts;
+  index = conf->stats_location != NGX_HTTP_BROTLI_STATS_NONE
+              ? conf->stats_location
+              : conf->stats_server;
+
+  type.len = r->headers_out.content_type_len ? r->headers_out.content_type_len
+                                             : r->headers_out.content_type.len;
+  type.len = ngx_min(type.len, NGX_HTTP_BROTLI_HIST_TYPE_LEN);
+  type.data = lowcase;
+  ngx_strlow(lowcase, r->headers_out.content_type.data, type.len);
+
+  ngx_crc32_init(hash);
+  ngx_crc32_update(&hash, keys[index].key.data, keys[index].key.len);
+  ngx_crc32_update(&hash, type.data, type.len);
+  ngx_crc32_final(hash);
+
+  /* Published nodes are not modified, so they are compared without lock. */
+  cached = &conf->hist_cache[hash % NGX_HTTP_BROTLI_HIST_CACHE];
+  hn = *cached;
+  if (hn && hn->node.key == hash && hn->type_len == type.len &&
+      ngx_memcmp(hn->data + hn->key_len, type.data, type.len) == 0) {
+    goto found;
+  }
+
+  ngx_shmtx_lock(&mcf->stats_shpool->mutex);
+  hn = ngx_http_brotli_hist_lookup(mcf, &keys[index].key, &type, hash);
+  ngx_shmtx_unlock(&mcf->stats_shpool->mutex);
+
+  if (hn == NULL) {
+    ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                  "brotli_stats_zone \"%V\" is full, histogram of \"%V\" "
+                  "is not updated",
+                  &mcf->stats_zone->shm.name, &type);
+    return;
+  }
+
+  *cached = hn;
+
+found:
+
+  ngx_http_brotli_hist_add(&hn->encoder_time, ctx->encoder_usec);
+  if (ctx->first_byte_usec) {
+    ngx_http_brotli_hist_add(&hn->first_byte,
+                             ctx->first_byte_usec - ctx->start_usec);
+  }
+  ngx_http_brotli_hist_add(&hn->size, ctx->bytes_out);
+  if (ctx->bytes_out) {
+    ngx_http_brotli_hist_add(&hn->ratio,
+                             (uint64_t)ctx->bytes_in * 100 / ctx->bytes_out);
+  }
+}
+
+/* Accounts finished request in server and location nodes. */
+static ngx_int_t ngx_http_brotli_stats_log_handler(ngx_http_request_t* r) {
+  ngx_http_brotli_main_conf_t* mcf;
+  ngx_http_brotli_conf_t* conf;
+  ngx_http_brotli_ctx_t* ctx;
+  ngx_http_variable_value_t* vv;
+  ngx_uint_t skipped;
+  ngx_uint_t reason;
+  ngx_uint_t static_hit;
+  ngx_uint_t static_miss;
+  off_t bytes;
+
+  mcf = ngx_http_get_module_main_conf(r, ngx_http_brotli_filter_module);
+  conf = ngx_http_get_module_loc_conf(r, ngx_http_brotli_filter_module);
+
+  if (conf->stats_server == NGX_HTTP_BROTLI_STATS_NONE) {
+    return NGX_OK;
+  }
+
+  ctx = ngx_http_get_module_ctx(r, ngx_http_brotli_filter_module);
+  reason = ngx_http_brotli_skip_reason(r);
+  if (reason != NGX_HTTP_BROTLI_SKIP_NONE) {
+    ctx = NULL;
+  }
+
+  static_hit = 0;
+  static_miss = 0;
+  if (mcf->static_index != NGX_ERROR) {
+    vv = ngx_http_get_indexed_variable(r, mcf->static_index);
+    if (vv && !vv->not_found) {
+      static_hit = (vv->len == 3 && ngx_strncmp(vv->data, "hit", 3) == 0);
+      static_miss = !static_hit;
+    }
+  }
+
+  /* Pre-compressed responses are not "skipped"; neither are responses of
+     locations, where compression is disabled. */
+  skipped = (ctx == NULL && conf->enable && !static_hit);
+  if (static_hit) {
+    reason = NGX_HTTP_BROTLI_SKIP_NONE;
+  }
+
+  if (ctx == NULL && !skipped && reason == NGX_HTTP_BROTLI_SKIP_NONE &&
+      !static_hit && !static_miss) {
+    return NGX_OK;
+  }
+
+  /* Same as $body_bytes_sent. */
+  bytes = r->connection->sent - r->header_size;
+  if (bytes < 0) {
+    bytes = 0;
+  }
+
+  ngx_http_brotli_stats_update(mcf->stats_nodes[conf->stats_server], ctx,
+                               skipped, reason, bytes, static_hit,
+                               static_miss);
+  if (conf->stats_location != NGX_HTTP_BROTLI_STATS_NONE) {
+    ngx_http_brotli_stats_update(mcf->stats_nodes[conf->stats_location], ctx,
+                                 skipped, reason, bytes, static_hit,
+                                 static_miss);
+  }
+
+  if (ctx && ctx->success) {
+    ngx_http_brotli_hist_update(r, mcf, conf, ctx);
+  }
+
+  return NGX_OK;
+}
+
+/* Descriptor of counter reported by status handler. */
+typedef struct {
+  /* JSON field name; Prometheus metric is "brotli_<kind>_<prometheus>". */
+  const char* json;
+  const char* prometheus;
+  const char* help;
+  size_t offset;
+  /* 1 if counter is in microseconds; Prometheus gets seconds then. */
+  unsigned usec : 1;
+} ngx_http_brotli_stats_metric_t;
+
+static ngx_http_brotli_stats_metric_t ngx_http_brotli_stats_metrics[] = {
+    {"compressed", "responses_compressed_total",
+     "Responses compressed on-the-fly.",
+     offsetof(ngx_http_brotli_stats_counters_t, compressed), 0},
+    {"skipped", "responses_skipped_total",
+     "Responses passed through uncompressed.",
+     offsetof(ngx_http_brotli_stats_counters_t, skipped), 0},
+    {"bytes_in", "bytes_in_total", "Uncompressed bytes pushed to encoder.",
+     offsetof(ngx_http_brotli_stats_counters_t, bytes_in), 0},
+    {"bytes_out", "bytes_out_total", "Compressed bytes produced by encoder.",
+     offsetof(ngx_http_brotli_stats_counters_t, bytes_out), 0},
+    {"encoder_usec", "encoder_seconds_total", "CPU time spent in encoder.",
+     offsetof(ngx_http_brotli_stats_counters_t, encoder_usec), 1},
+    {"static_hits", "static_hits_total", "Pre-compressed files served.",
+     offsetof(ngx_http_brotli_stats_counters_t, static_hits), 0},
+    {"static_misses", "static_misses_total",
+     "Pre-compressed files looked up, but not found.",
+     offsetof(ngx_http_brotli_stats_counters_t, static_misses), 0},
+    {"errors", "errors_total", "Compression streams that failed.",
+     offsetof(ngx_http_brotli_stats_counters_t, errors), 0},
+    {NULL, NULL, NULL, 0, 0}};
+
+#define ngx_http_brotli_stats_value(node, metric)                       \
+  (*(ngx_atomic_t*)((u_char*)&(node)->counters + (metric)->offset))
+
+/* Upper bound of event log line; MIME type is added separately. */
+#define NGX_HTTP_BROTLI_EVENT_SIZE 512
+
+/* Writes sampled compression event to the event log buffer. */
+static ngx_int_t ngx_http_brotli_event_log_handler(ngx_http_request_t* r) {
+  ngx_http_brotli_main_conf_t* mcf;
+  ngx_http_brotli_event_log_t* log;
+  ngx_http_brotli_ctx_t* ctx;
+  ngx_time_t* tp;
+  ngx_str_t type;
+  u_char* p;
+  size_t len;
+
+  ctx = ngx_http_get_module_ctx(r, ngx_http_brotli_filter_module);
+
+  /* Only responses that went through the encoder are logged. */
+  if (ctx == NULL || ctx->lg_win == 0) {
+    return NGX_OK;
+  }
+
+  mcf = ngx_http_get_module_main_conf(r, ngx_http_brotli_filter_module);
+  log = mcf->event_log;
+
+  if (log->sample > 1 && (ngx_uint_t)ngx_random() % log->sample) {
+    return NGX_OK;
+  }
+
+  type.len = r->headers_out.content_type_len ? r->headers_out.content_type_len
+                                             : r->headers_out.content_type.len;
+  type.len = ngx_min(type.len, NGX_HTTP_BROTLI_HIST_TYPE_LEN);
+  type.data = r->headers_out.content_type.data;
+
+  len = NGX_HTTP_BROTLI_EVENT_SIZE + type.len +
+        ngx_escape_json(NULL, type.data, type.len);
+
+  if (len > (size_t)(log->last - log->pos)) {
+    ngx_http_brotli_event_log_flush(log->file, r->connection->log);
+  }
+
+  if (len > (size_t)(log->last - log->pos)) {
+    return NGX_OK;
+  }
+
+  tp = ngx_timeofday();
+  p = log->pos;
+
+  p = ngx_sprintf(p, "{\"time\":%T.%03M,\"uri_hash\":\"%08xD\",\"type\":\"",
+                  tp->sec, tp->msec, ngx_crc32_long(r->uri.data, r->uri.len));
+  p = (u_char*)ngx_escape_json(p, type.data, type.len);
+  p = ngx_sprintf(p,
+                  "\",\"status\":%ui,\"ok\":%s,\"bytes_in\":%uz,"
+                  "\"bytes_out\":%uz,\"quality\":%i,\"window\":%uz,"
+                  "\"encoder_usec\":%uL,\"block_max_usec\":%uL,"
+                  "\"stalls\":%ui,\"flushes\":%ui,\"peak_memory\":%uz}\n",
+                  r->headers_out.status, ctx->success ? "true" : "false",
+                  ctx->bytes_in, ctx->bytes_out, ctx->quality,
+                  (size_t)1 << ctx->lg_win, ctx->encoder_usec,
+                  ctx->block_max_usec, ctx->stalls, ctx->flushes,
+                  ctx->peak_memory);
+
+  if (log->pos == log->start && !log->event->timer_set) {
+    ngx_add_timer(log->event, log->flush);
+  }
+
+  log->pos = p;
+
+  return NGX_OK;
+}
+
+static void ngx_http_brotli_event_log_flush(ngx_open_file_t* file,
+                                            ngx_log_t* log) {
+  ngx_http_brotli_event_log_t* el = file->data;
+  u_char* p;
+  ssize_t n;
+  size_t len;
+
+  len = el->pos - el->start;
+  if (len == 0) {
+    return;
+  }
+
+  p = el->start;
+
+  /* Every flush is a complete stream, written at once; streams of workers
+     sharing the file do not interleave. */
+  if (el->quality != -1) {
+    p = el->out;
+    n = len;
+    len = el->out_size;
+    if (!BrotliEncoderCompress((int)el->quality, BROTLI_DEFAULT_WINDOW,
+                               BROTLI_MODE_TEXT, (size_t)n, el->start, &len,
+                               p)) {
+      ngx_log_error(NGX_LOG_ALERT, log, 0,
+                    "BrotliEncoderCompress() of %z bytes for \"%s\" failed",
+                    n, file->name.data);
+      goto done;
+    }
+  }
+
+  n = ngx_write_fd(file->fd, p, len);
+
+  if (n == -1) {
+    ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                  ngx_write_fd_n " to \"%s\" failed", file->name.data);
+
+  } else if ((size_t)n != len) {
+    /* Not retried: the rest could land after other workers' streams. The
+       stream is left truncated, and script/brcat.py skips it. */
+    ngx_log_error(NGX_LOG_ALERT, log, 0,
+                  ngx_write_fd_n " to \"%s\" was incomplete: %z of %uz",
+                  file->name.data, n, len);
+  }
+
+done:
+
+  el->pos = el->start;
+
+  if (el->event->timer_set) {
+    ngx_del_timer(el->event);
+  }
+}
+
+static void ngx_http_brotli_event_log_flush_handler(ngx_event_t* ev) {
+  ngx_http_brotli_event_log_t* el = ev->data;
+
+  ngx_http_brotli_event_log_flush(el->file, ev->log);
+}
+
+static void ngx_http_brotli_exit_process(ngx_cycle_t* cycle) {
+  ngx_http_brotli_main_conf_t* mcf;
+
+  mcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                            ngx_http_brotli_filter_module);
+  if (mcf && mcf->event_log) {
+    ngx_http_brotli_event_log_flush(mcf->event_log->file, cycle->log);
+  }
+}
+
+/* Upper bound of report line (JSON: node) size; names are added separately. */
+#define NGX_HTTP_BROTLI_STATS_LINE_SIZE 128
+/* Upper bound of Prometheus HELP/TYPE preamble. */
+#define NGX_HTTP_BROTLI_STATS_METRIC_SIZE 256
+
+#define NGX_HTTP_BROTLI_STATS_METRICS_N                  \
+  (sizeof(ngx_http_brotli_stats_metrics) /               \
+       sizeof(ngx_http_brotli_stats_metric_t) -          \
+   1)
+
+/* Descriptor of histogram reported by status handler. */
+typedef struct {
+  /* JSON field name; Prometheus metric is "brotli_<name>". */
+  const char* name;
+  const char* help;
+  size_t offset;
+  /* Reported value is stored one divided by scale: 1, 100 or 1000000. */
+  uint64_t scale;
+} ngx_http_brotli_hist_metric_t;
+
+static ngx_http_brotli_hist_metric_t ngx_http_brotli_hist_metrics[] = {
+    {"encoder_seconds", "CPU time spent in encoder per response.",
+     offsetof(ngx_http_brotli_hist_node_t, encoder_time), 1000000},
+    {"first_byte_seconds",
+     "Time from response header to first compressed byte.",
+     offsetof(ngx_http_brotli_hist_node_t, first_byte), 1000000},
+    {"response_size_bytes", "Compressed response size.",
+     offsetof(ngx_http_brotli_hist_node_t, size), 1},
+    {"ratio", "Compression ratio.",
+     offsetof(ngx_http_brotli_hist_node_t, ratio), 100},
+    {NULL, NULL, 0, 0}};
+
+/* Descriptor of worker or encoder value reported by status handler. */
+typedef struct {
+  /* JSON field name; Prometheus metric is "brotli_<kind>_<prometheus>". */
+  const char* json;
+  const char* prometheus;
+  const char* help;
+  const char* type;
+  size_t offset;
+  /* 1 if value is in microseconds; Prometheus gets seconds then. */
+  unsigned usec : 1;
+} ngx_http_brotli_usage_metric_t;
+
+static ngx_http_brotli_usage_metric_t ngx_http_brotli_worker_metrics[] = {
+    {"memory", "memory_bytes", "Bytes currently allocated by encoders.",
+     "gauge", offsetof(ngx_http_brotli_worker_t, memory.live), 0},
+    {"peak_memory", "memory_peak_bytes",
+     "Peak of bytes allocated by encoders at once.", "gauge",
+     offsetof(ngx_http_brotli_worker_t, memory.peak), 0},
+    {"stream_peak_memory", "stream_memory_peak_bytes",
+     "Peak of bytes allocated by a single encoder.", "gauge",
+     offsetof(ngx_http_brotli_worker_t, memory.stream_peak), 0},
+    {"encoders", "encoders", "Encoders currently alive.", "gauge",
+     offsetof(ngx_http_brotli_worker_t, memory.encoders), 0},
+    {"streams", "streams_total", "Encoders created.", "counter",
+     offsetof(ngx_http_brotli_worker_t, memory.streams), 0},
+    {"blocks", "blocks_total", "Body filter calls that invoked encoder.",
+     "counter", offsetof(ngx_http_brotli_worker_t, blocks), 0},
+    {"slow_blocks", "slow_blocks_total",
+     "Body filter calls that exceeded brotli_block_warn.", "counter",
+     offsetof(ngx_http_brotli_worker_t, slow_blocks), 0},
+    {"block_usec", "block_seconds_total",
+     "Time event loop was blocked in encoder.", "counter",
+     offsetof(ngx_http_brotli_worker_t, block_usec), 1},
+    {"block_max_usec", "block_max_seconds",
+     "Longest time event loop was blocked in encoder by a single call.",
+     "gauge", offsetof(ngx_http_brotli_worker_t, block_max_usec), 1},
+    {"block_second_max_usec", "block_second_max_seconds",
+     "Most time event loop was blocked in encoder within a second.", "gauge",
+     offsetof(ngx_http_brotli_worker_t, block_second_max_usec), 1},
+    {"queued_input", "queued_input_bytes",
+     "Input bytes queued in body filters of live streams.", "gauge",
+     offsetof(ngx_http_brotli_worker_t, queued_input), 0},
+    {"pool", "pool_bytes",
+     "Bytes used in request pools of live streams, less large allocations.",
+     "gauge", offsetof(ngx_http_brotli_worker_t, pool), 0},
+    {NULL, NULL, NULL, NULL, 0, 0}};
+
+#define NGX_HTTP_BROTLI_WORKER_METRICS_N                 \
+  (sizeof(ngx_http_brotli_worker_metrics) /              \
+       sizeof(ngx_http_brotli_usage_metric_t) -          \
+   1)
+
+static ngx_http_brotli_usage_metric_t ngx_http_brotli_encoder_metrics[] = {
+    {"memory", "memory_bytes", "Bytes currently allocated by encoders.",
+     "gauge", offsetof(ngx_http_brotli_memory_t, live), 0},
+    {"peak_memory", "memory_peak_bytes",
+     "Peak of bytes allocated by encoders at once.", "gauge",
+     offsetof(ngx_http_brotli_memory_t, peak), 0},
+    {"stream_peak_memory", "stream_memory_peak_bytes",
+     "Peak of bytes allocated by a single encoder.", "gauge",
+     offsetof(ngx_http_brotli_memory_t, stream_peak), 0},
+    {"encoders", "encoders", "Encoders currently alive.", "gauge",
+     offsetof(ngx_http_brotli_memory_t, encoders), 0},
+    {"streams", "streams_total", "Encoders created.", "counter",
+     offsetof(ngx_http_brotli_memory_t, streams), 0},
+    {NULL, NULL, NULL, NULL, 0, 0}};
+
+#define NGX_HTTP_BROTLI_ENCODER_METRICS_N                \
+  (sizeof(ngx_http_brotli_encoder_metrics) /             \
+       sizeof(ngx_http_brotli_usage_metric_t) -          \
+   1)
+
+static ngx_http_brotli_usage_metric_t ngx_http_brotli_tenant_metrics[] = {
+    {"encoder_usec", "encoder_seconds_total", "CPU time spent in encoder.",
+     "counter", offsetof(ngx_http_brotli_tenant_t, usec), 1},
+    {"window_encoder_usec", "window_encoder_seconds",
+     "CPU time spent in encoder within current quota window.", "gauge",
+     offsetof(ngx_http_brotli_tenant_t, window_usec), 1},
+    {"streams", "streams_total", "Encoders created.", "counter",
+     offsetof(ngx_http_brotli_tenant_t, streams), 0},
+    {"over_quota", "over_quota_total", "Encoders created while over quota.",
+     "counter", offsetof(ngx_http_brotli_tenant_t, over_quota), 0},
+    {"degraded", "degraded_total",
+     "Encoders created with lower quality because of quota.", "counter",
+     offsetof(ngx_http_brotli_tenant_t, degraded), 0},
+    {NULL, NULL, NULL, NULL, 0, 0}};
+
+#define NGX_HTTP_BROTLI_TENANT_METRICS_N                 \
+  (sizeof(ngx_http_brotli_tenant_metrics) /              \
+       sizeof(ngx_http_brotli_usage_metric_t) -          \
+   1)
+
+#define ngx_http_brotli_usage_value(m, metric)                          \
+  (*(ngx_atomic_t*)((u_char*)(m) + (metric)->offset))
+
+/* Escaped names of histogram node. */
+typedef struct {
+  ngx_str_t server;
+  ngx_str_t location;
+  ngx_str_t type;
+} ngx_http_brotli_hist_names_t;
+
+/* Appends buffer of given size to output chain. */
+static ngx_buf_t* ngx_http_brotli_status_buf(ngx_http_request_t* r,
+                                             ngx_chain_t*** ll, size_t size) {
+  ngx_chain_t* cl;
+  ngx_buf_t* b;
+
+  b = ngx_create_temp_buf(r->pool, size);
+  if (b == NULL) {
+    return NULL;
+  }
+
+  cl = ngx_alloc_chain_link(r->pool);
+  if (cl == NULL) {
+    return NULL;
+  }
+
+  cl->buf = b;
+  cl->next = NULL;
+  **ll = cl;
+  *ll = &cl->next;
+
+  return b;
+}
+
+static ngx_int_t ngx_http_brotli_status_escape(
+    ngx_http_request_t* r, ngx_str_t* dst, u_char* src, size_t len,
+    ngx_http_brotli_escape_pt escape) {
+  dst->len = len + escape(NULL, src, len);
+  dst->data = ngx_pnalloc(r->pool, dst->len + 1);
+  if (dst->data == NULL) {
+    return NGX_ERROR;
+  }
+
+  escape(dst->data, src, len);
+
+  return NGX_OK;
+}
+
+/* Splits histogram node key (see ngx_http_brotli_stats_key_t) to names. */
+static ngx_int_t ngx_http_brotli_hist_names(ngx_http_request_t* r,
+                                            ngx_http_brotli_hist_node_t* hn,
+                                            ngx_http_brotli_hist_names_t* n,
+                                            ngx_http_brotli_escape_pt escape) {
+  u_char* server;
+  u_char* end;
+  u_char* sp;
+
+  server = hn->data + 1;
+  end = hn->data + hn->key_len;
+  sp = (hn->data[0] == 'l') ? ngx_strlchr(server, end, ' ') : NULL;
+
+  if (ngx_http_brotli_status_escape(r, &n->server, server,
+                                    (sp ? sp : end) - server, escape) !=
+          NGX_OK ||
+      ngx_http_brotli_status_escape(r, &n->location, sp ? sp + 1 : end,
+                                    sp ? end - sp - 1 : 0, escape) != NGX_OK ||
+      ngx_http_brotli_status_escape(r, &n->type, end, hn->type_len, escape) !=
+          NGX_OK) {
+    return NGX_ERROR;
+  }
+
+  return NGX_OK;
+}
+
+static u_char* ngx_http_brotli_hist_value(u_char* p, u_char* last,
+                                          uint64_t value, uint64_t scale) {
+  switch (scale) {
+    case 100:
+      return ngx_slprintf(p, last, "%uL.%02uL", value / 100, value % 100);
+    case 1000000:
+      return ngx_slprintf(p, last, "%uL.%06uL", value / 1000000,
+                          value % 1000000);
+    default:
+      return ngx_slprintf(p, last, "%uL", value);
+  }
+}
+
+/* Prints usage value; in seconds, if it is in microseconds and "seconds" is
+   set. */
+static u_char* ngx_http_brotli_usage_print(u_char* p, u_char* last,
+                                           ngx_http_brotli_usage_metric_t* um,
+                                           void* base, ngx_uint_t seconds) {
+  ngx_atomic_uint_t value;
+
+  value = ngx_http_brotli_usage_value(base, um);
+
+  if (um->usec && seconds) {
+    return ngx_slprintf(p, last, "%uA.%06uA", value / 1000000,
+                        value % 1000000);
+  }
+
+  return ngx_slprintf(p, last, "%uA", value);
+}
+
+/* Reports accounting of workers, and encoder memory per (quality, window)
+   pair that was ever used. */
+static ngx_int_t ngx_http_brotli_status_usage_json(
+    ngx_http_request_t* r, ngx_http_brotli_main_conf_t* mcf,
+    ngx_chain_t*** ll) {
+  ngx_http_brotli_usage_metric_t* um;
+  ngx_http_brotli_memory_t* m;
+  ngx_uint_t quality;
+  ngx_uint_t window;
+  ngx_uint_t i;
+  ngx_uint_t n;
+  ngx_buf_t* b;
+
+  b = ngx_http_brotli_status_buf(
+      r, ll,
+      sizeof(",\"workers\":[],\"encoders\":[]") +
+          (mcf->stats_sh->nworkers * (NGX_HTTP_BROTLI_WORKER_METRICS_N + 1) +
+           (BROTLI_MAX_QUALITY + 1) * NGX_HTTP_BROTLI_WINDOWS *
+               (NGX_HTTP_BROTLI_ENCODER_METRICS_N + 1)) *
+              NGX_HTTP_BROTLI_STATS_LINE_SIZE / 2);
+  if (b == NULL) {
+    return NGX_ERROR;
+  }
+
+  b->last = ngx_slprintf(b->last, b->end, ",\"workers\":[");
+
+  for (i = 0; i < mcf->stats_sh->nworkers; i++) {
+    b->last = ngx_slprintf(b->last, b->end, "%s{\"worker\":%ui",
+                           i ? "," : "", i);
+    for (um = ngx_http_brotli_worker_metrics; um->json; um++) {
+      b->last = ngx_slprintf(b->last, b->end, ",\"%s\":", um->json);
+      b->last = ngx_http_brotli_usage_print(b->last, b->end, um,
+                                            &mcf->stats_sh->workers[i], 0);
+    }
+    b->last = ngx_slprintf(b->last, b->end, "}");
+  }
+
+  b->last = ngx_slprintf(b->last, b->end, "],\"encoders\":[");
+
+  n = 0;
+  for (quality = 0; quality <= BROTLI_MAX_QUALITY; quality++) {
+    for (window = 0; window < NGX_HTTP_BROTLI_WINDOWS; window++) {
+      m = &mcf->stats_sh->encoders[quality][window];
+      if (m->streams == 0) {
+        continue;
+      }
+
+      b->last = ngx_slprintf(b->last, b->end,
+                             "%s{\"quality\":%ui,\"window\":%uz",
+                             n++ ? "," : "", quality,
+                             (size_t)1 << (window + BROTLI_MIN_WINDOW_BITS));
+      for (um = ngx_http_brotli_encoder_metrics; um->json; um++) {
+        b->last = ngx_slprintf(b->last, b->end, ",\"%s\":", um->json);
+        b->last = ngx_http_brotli_usage_print(b->last, b->end, um, m, 0);
+      }
+      b->last = ngx_slprintf(b->last, b->end, "}");
+    }
+  }
+
+  b->last = ngx_slprintf(b->last, b->end, "]");
+
+  return NGX_OK;
+}
+
+static ngx_int_t ngx_http_brotli_status_usage_prometheus(
+    ngx_http_request_t* r, ngx_http_brotli_main_conf_t* mcf,
+    ngx_chain_t*** ll) {
+  ngx_http_brotli_usage_metric_t* um;
+  ngx_http_brotli_memory_t* m;
+  ngx_uint_t quality;
+  ngx_uint_t window;
+  ngx_uint_t i;
+  ngx_buf_t* b;
+
+  b = ngx_http_brotli_status_buf(
+      r, ll,
+      (NGX_HTTP_BROTLI_WORKER_METRICS_N + NGX_HTTP_BROTLI_ENCODER_METRICS_N) *
+              2 * NGX_HTTP_BROTLI_STATS_METRIC_SIZE +
+          (NGX_HTTP_BROTLI_WORKER_METRICS_N * mcf->stats_sh->nworkers +
+           NGX_HTTP_BROTLI_ENCODER_METRICS_N * (BROTLI_MAX_QUALITY + 1) *
+               NGX_HTTP_BROTLI_WINDOWS) *
+              NGX_HTTP_BROTLI_STATS_LINE_SIZE);
+  if (b == NULL) {
+    return NGX_ERROR;
+  }
+
+  for (um = ngx_http_brotli_worker_metrics; um->json; um++) {
+    b->last = ngx_slprintf(b->last, b->end,
+                           "# HELP brotli_worker_%s %s\n"
+                           "# TYPE brotli_worker_%s %s\n",
+                           um->prometheus, um->help, um->prometheus, um->type);
+
+    for (i = 0; i < mcf->stats_sh->nworkers; i++) {
+      b->last = ngx_slprintf(b->last, b->end,
+                             "brotli_worker_%s{worker=\"%ui\"} ",
+                             um->prometheus, i);
+      b->last = ngx_http_brotli_usage_print(b->last, b->end, um,
+                                            &mcf->stats_sh->workers[i], 1);
+      b->last = ngx_slprintf(b->last, b->end, "\n");
+    }
+  }
+
+  for (um = ngx_http_brotli_encoder_metrics; um->json; um++) {
+    b->last = ngx_slprintf(b->last, b->end,
+                           "# HELP brotli_encoder_%s %s\n"
+                           "# TYPE brotli_encoder_%s %s\n",
+                           um->prometheus, um->help, um->prometheus, um->type);
+
+    for (quality = 0; quality <= BROTLI_MAX_QUALITY; quality++) {
+      for (window = 0; window < NGX_HTTP_BROTLI_WINDOWS; window++) {
+        m = &mcf->stats_sh->encoders[quality][window];
+        if (m->streams == 0) {
+          continue;
+        }
+
+        b->last = ngx_slprintf(
+            b->last, b->end,
+            "brotli_encoder_%s{quality=\"%ui\",window=\"%uz\"} ",
+            um->prometheus, quality,
+            (size_t)1 << (window + BROTLI_MIN_WINDOW_BITS));
+        b->last = ngx_http_brotli_usage_print(b->last, b->end, um, m, 1);
+        b->last = ngx_slprintf(b->last, b->end, "\n");
+      }
+    }
+  }
+
+  return NGX_OK;
+}
+
+/* Escapes names of tenants, as of "tenants" snapshot; returns their total
+   length. */
+static ngx_int_t ngx_http_brotli_tenant_names(
+    ngx_http_request_t* r, ngx_http_brotli_tenant_t* tenants,
+    ngx_array_t* names, size_t* len, ngx_http_brotli_escape_pt escape) {
+  ngx_http_brotli_tenant_t* t;
+  ngx_str_t* name;
+
+  if (ngx_array_init(names, r->pool, 8, sizeof(ngx_str_t)) != NGX_OK) {
+    return NGX_ERROR;
+  }
+
+  *len = 0;
+  for (t = tenants; t; t = t->next) {
+    name = ngx_array_push(names);
+    if (name == NULL ||
+        ngx_http_brotli_status_escape(r, name, t->data, t->sn.str.len,
+                                      escape) != NGX_OK) {
+      return NGX_ERROR;
+    }
+    *len += name->len;
+  }
+
+  return NGX_OK;
+}
+
+static ngx_int_t ngx_http_brotli_status_tenants_json(
+    ngx_http_request_t* r, ngx_http_brotli_main_conf_t* mcf,
+    ngx_chain_t*** ll) {
+  ngx_http_brotli_usage_metric_t* um;
+  ngx_http_brotli_tenant_t* tenants;
+  ngx_http_brotli_tenant_t* t;
+  ngx_array_t names;
+  ngx_str_t* name;
+  ngx_uint_t i;
+  ngx_buf_t* b;
+  size_t len;
+
+  tenants = mcf->stats_sh->tenants;
+  if (ngx_http_brotli_tenant_names(r, tenants, &names, &len,
+                                   ngx_escape_json) != NGX_OK) {
+    return NGX_ERROR;
+  }
+
+  b = ngx_http_brotli_status_buf(
+      r, ll,
+      sizeof(",\"tenants\":[]") + len +
+          names.nelts * (NGX_HTTP_BROTLI_TENANT_METRICS_N + 1) *
+              NGX_HTTP_BROTLI_STATS_LINE_SIZE / 2);
+  if (b == NULL) {
+    return NGX_ERROR;
+  }
+
+  b->last = ngx_slprintf(b->last, b->end, ",\"tenants\":[");
+
+  name = names.elts;
+  for (t = tenants, i = 0; t; t = t->next, i++) {
+    b->last = ngx_slprintf(b->last, b->end, "%s{\"tenant\":\"%V\"",
+                           i ? "," : "", &name[i]);
+    for (um = ngx_http_brotli_tenant_metrics; um->json; um++) {
+      b->last = ngx_slprintf(b->last, b->end, ",\"%s\":", um->json);
+      b->last = ngx_http_brotli_usage_print(b->last, b->end, um, t, 0);
+    }
+    b->last = ngx_slprintf(b->last, b->end, "}");
+  }
+
+  b->last = ngx_slprintf(b->last, b->end, "]");
+
+  return NGX_OK;
+}
+
+static ngx_int_t ngx_http_brotli_status_tenants_prometheus(
+    ngx_http_request_t* r, ngx_http_brotli_main_conf_t* mcf,
+    ngx_chain_t*** ll) {
+  ngx_http_brotli_usage_metric_t* um;
+  ngx_http_brotli_tenant_t* tenants;
+  ngx_http_brotli_tenant_t* t;
+  ngx_array_t names;
+  ngx_str_t* name;
+  ngx_uint_t i;
+  ngx_buf_t* b;
+  size_t len;
+
+  tenants = mcf->stats_sh->tenants;
+  if (tenants == NULL) {
+    return NGX_OK;
+  }
+
+  if (ngx_http_brotli_tenant_names(r, tenants, &names, &len,
+                                   ngx_http_brotli_escape_prometheus) !=
+      NGX_OK) {
+    return NGX_ERROR;
+  }
+
+  b = ngx_http_brotli_status_buf(
+      r, ll,
+      NGX_HTTP_BROTLI_TENANT_METRICS_N *
+          (2 * NGX_HTTP_BROTLI_STATS_METRIC_SIZE + len +
+           names.nelts * NGX_HTTP_BROTLI_STATS_LINE_SIZE));
+  if (b == NULL) {
+    return NGX_ERROR;
+  }
+
+  name = names.elts;
+  for (um = ngx_http_brotli_tenant_metrics; um->json; um++) {
+    b->last = ngx_slprintf(b->last, b->end,
+                           "# HELP brotli_tenant_%s %s\n"
+                           "# TYPE brotli_tenant_%s %s\n",
+                           um->prometheus, um->help, um->prometheus, um->type);
+
+    for (t = tenants, i = 0; t; t = t->next, i++) {
+      b->last = ngx_slprintf(b->last, b->end,
+                             "brotli_tenant_%s{tenant=\"%V\"} ",
+                             um->prometheus, &name[i]);
+      b->last = ngx_http_brotli_usage_print(b->last, b->end, um, t, 1);
+      b->last = ngx_slprintf(b->last, b->end, "\n");
+    }
+  }
+
+  return NGX_OK;
+}
+
+static ngx_int_t ngx_http_brotli_status_json(ngx_http_request_t* r,
+                                             ngx_http_brotli_main_conf_t* mcf,
+                                             ngx_chain_t*** ll,
+                                             ngx_http_brotli_hist_node_t* hist) {
+  ngx_http_brotli_stats_counters_t* c;
+  ngx_http_brotli_stats_key_t* keys;
+  ngx_http_brotli_stats_metric_t* m;
+  ngx_http_brotli_hist_metric_t* hm;
+  ngx_http_brotli_hist_node_t* hn;
+  ngx_http_brotli_hist_names_t names;
+  ngx_http_brotli_hist_t h;
+  ngx_uint_t reason;
+  ngx_uint_t kind;
+  ngx_uint_t i;
+  ngx_uint_t n;
+  ngx_uint_t k;
+  ngx_buf_t* b;
+  size_t size;
+
+  keys = mcf->stats_keys.elts;
+
+  size = sizeof("{\"servers\":[],\"locations\":[]");
+  for (i = 0; i < mcf->stats_keys.nelts; i++) {
+    size += (NGX_HTTP_BROTLI_STATS_METRICS_N + NGX_HTTP_BROTLI_SKIP_N + 1) *
+                NGX_HTTP_BROTLI_STATS_LINE_SIZE +
+            keys[i].server.len + keys[i].location.len;
+  }
+
+  b = ngx_http_brotli_status_buf(r, ll, size);
+  if (b == NULL) {
+    return NGX_ERROR;
+  }
+
+  b->last = ngx_slprintf(b->last, b->end, "{");
+
+  for (kind = 0; kind < 2; kind++) {
+    b->last = ngx_slprintf(b->last, b->end, "%s\"%s\":[", kind ? "," : "",
+                           kind ? "locations" : "servers");
+
+    for (i = 0, n = 0; i < mcf->stats_keys.nelts; i++) {
+      if (keys[i].is_location != kind) {
+        continue;
+      }
+
+      b->last = ngx_slprintf(b->last, b->end, "%s{\"server\":\"%V\"",
+                             n++ ? "," : "", &keys[i].server);
+      if (kind) {
+        b->last = ngx_slprintf(b->last, b->end, ",\"location\":\"%V\"",
+                               &keys[i].location);
+      }
+
+      for (m = ngx_http_brotli_stats_metrics; m->json; m++) {
+        b->last = ngx_slprintf(
+            b->last, b->end, ",\"%s\":%uA", m->json,
+            ngx_http_brotli_stats_value(mcf->stats_nodes[i], m));
+      }
+
+      c = &mcf->stats_nodes[i]->counters;
+      b->last = ngx_slprintf(b->last, b->end, ",\"skip\":{");
+      for (reason = 1, k = 0; reason < NGX_HTTP_BROTLI_SKIP_N; reason++) {
+        if (c->skip_responses[reason] == 0) {
+          continue;
+        }
+
+        b->last = ngx_slprintf(b->last, b->end,
+                               "%s\"%V\":{\"responses\":%uA,\"bytes\":%uA}",
+                               k++ ? "," : "",
+                               &ngx_http_brotli_skip_reasons[reason],
+                               c->skip_responses[reason],
+                               c->skip_bytes[reason]);
+      }
+
+      b->last = ngx_slprintf(b->last, b->end, "}}");
+    }
+
+    b->last = ngx_slprintf(b->last, b->end, "]");
+  }
+
+  if (ngx_http_brotli_status_usage_json(r, mcf, ll) != NGX_OK ||
+      ngx_http_brotli_status_tenants_json(r, mcf, ll) != NGX_OK) {
+    return NGX_ERROR;
+  }
+
+  b = ngx_http_brotli_status_buf(r, ll, sizeof(",\"histograms\":["));
+  if (b == NULL) {
+    return NGX_ERROR;
+  }
+  b->last = ngx_slprintf(b->last, b->end, ",\"histograms\":[");
+
+  for (hn = hist; hn; hn = hn->next) {
+    if (ngx_http_brotli_hist_names(r, hn, &names, ngx_escape_json) !=
+        NGX_OK) {
+      return NGX_ERROR;
+    }
+
+    size = NGX_HTTP_BROTLI_STATS_LINE_SIZE + names.server.len +
+           names.location.len + names.type.len;
+    for (hm = ngx_http_brotli_hist_metrics; hm->name; hm++) {
+      size += NGX_HTTP_BROTLI_STATS_LINE_SIZE +
+              NGX_HTTP_BROTLI_HIST_BUCKETS * (2 * NGX_ATOMIC_T_LEN + 8);
+    }
+
+    b = ngx_http_brotli_status_buf(r, ll, size);
+    if (b == NULL) {
+      return NGX_ERROR;
+    }
+
+    b->last = ngx_slprintf(b->last, b->end,
+                           "%s{\"server\":\"%V\",\"location\":\"%V\","
+                           "\"type\":\"%V\"",
+                           hn == hist ? "" : ",", &names.server,
+                           &names.location, &names.type);
+
+    for (hm = ngx_http_brotli_hist_metrics; hm->name; hm++) {
+      ngx_memcpy(&h, (u_char*)hn + hm->offset, sizeof(ngx_http_brotli_hist_t));
+
+      b->last = ngx_slprintf(b->last, b->end, ",\"%s\":{\"count\":%uA,\"sum\":",
+                             hm->name, h.count);
+      b->last = ngx_http_brotli_hist_value(b->last, b->end, h.sum, hm->scale);
+      b->last = ngx_slprintf(b->last, b->end, ",\"buckets\":[");
+
+      for (i = 0, n = 0; i < NGX_HTTP_BROTLI_HIST_BUCKETS; i++) {
+        if (h.buckets[i] == 0) {
+          continue;
+        }
+
+        b->last = ngx_slprintf(b->last, b->end, "%s[", n++ ? "," : "");
+        if (i == NGX_HTTP_BROTLI_HIST_BUCKETS - 1) {
+          b->last = ngx_slprintf(b->last, b->end, "null");
+        } else {
+          b->last = ngx_http_brotli_hist_value(
+              b->last, b->end, ngx_http_brotli_hist_bucket_bound(i),
+              hm->scale);
+        }
+        b->last = ngx_slprintf(b->last, b->end, ",%uA]", h.buckets[i]);
+      }
+
+      b->last = ngx_slprintf(b->last, b->end, "]}");
+    }
+
+    b->last = ngx_slprintf(b->last, b->end, "}");
+  }
+
+  b = ngx_http_brotli_status_buf(r, ll, sizeof("]}" CRLF));
+  if (b == NULL) {
+    return NGX_ERROR;
+  }
+  b->last = ngx_slprintf(b->last, b->end, "]}" CRLF);
+
+  return NGX_OK;
+}
+
+static ngx_int_t ngx_http_brotli_status_prometheus(
+    ngx_http_request_t* r, ngx_http_brotli_main_conf_t* mcf,
+    ngx_chain_t*** ll, ngx_http_brotli_hist_node_t* hist) {
+  ngx_http_brotli_stats_counters_t* c;
+  ngx_http_brotli_stats_key_t* keys;
+  ngx_http_brotli_stats_metric_t* m;
+  ngx_http_brotli_hist_metric_t* hm;
+  ngx_http_brotli_hist_node_t* hn;
+  ngx_http_brotli_hist_names_t names;
+  ngx_http_brotli_hist_t h;
+  ngx_atomic_uint_t value;
+  ngx_atomic_uint_t cumulative;
+  const char* name;
+  ngx_uint_t reason;
+  ngx_uint_t kind;
+  ngx_uint_t bytes;
+  ngx_uint_t i;
+  ngx_buf_t* b;
+  size_t labels;
+  size_t size;
+
+  keys = mcf->stats_keys.elts;
+
+  /* Counters; Prometheus repeats names for every metric. */
+  size = 2 * (NGX_HTTP_BROTLI_STATS_METRICS_N + 2) *
+         NGX_HTTP_BROTLI_STATS_METRIC_SIZE;
+  for (i = 0; i < mcf->stats_keys.nelts; i++) {
+    size += (NGX_HTTP_BROTLI_STATS_METRICS_N + 2 * NGX_HTTP_BROTLI_SKIP_N) *
+            (NGX_HTTP_BROTLI_STATS_LINE_SIZE + keys[i].server_label.len +
+             keys[i].location_label.len);
+  }
+
+  b = ngx_http_brotli_status_buf(r, ll, size);
+  if (b == NULL) {
+    return NGX_ERROR;
+  }
+
+  for (kind = 0; kind < 2; kind++) {
+    name = kind ? "location" : "server";
+
+    for (m = ngx_http_brotli_stats_metrics; m->json; m++) {
+      b->last = ngx_slprintf(b->last, b->end,
+                             "# HELP brotli_%s_%s %s\n"
+                             "# TYPE brotli_%s_%s counter\n",
+                             name, m->prometheus, m->help, name,
+                             m->prometheus);
+
+      for (i = 0; i < mcf->stats_keys.nelts; i++) {
+        if (keys[i].is_location != kind) {
+          continue;
+        }
+
+        b->last = ngx_slprintf(b->last, b->end, "brotli_%s_%s{server=\"%V\"",
+                               name, m->prometheus, &keys[i].server_label);
+        if (kind) {
+          b->last = ngx_slprintf(b->last, b->end, ",location=\"%V\"",
+                                 &keys[i].location_label);
+        }
+
+        value = ngx_http_brotli_stats_value(mcf->stats_nodes[i], m);
+        if (m->usec) {
+          b->last = ngx_slprintf(b->last, b->end, "} %uA.%06uA\n",
+                                 value / 1000000, value % 1000000);
+        } else {
+          b->last = ngx_slprintf(b->last, b->end, "} %uA\n", value);
+        }
+      }
+    }
+
+    /* Reasons responses were not compressed; all of them, so that series
+       are stable. */
+    for (bytes = 0; bytes < 2; bytes++) {
+      b->last = ngx_slprintf(
+          b->last, b->end,
+          "# HELP brotli_%s_skip_%s_total %s passed through uncompressed, "
+          "by reason.\n"
+          "# TYPE brotli_%s_skip_%s_total counter\n",
+          name, bytes ? "bytes" : "responses",
+          bytes ? "Body bytes of responses" : "Responses", name,
+          bytes ? "bytes" : "responses");
+
+      for (i = 0; i < mcf->stats_keys.nelts; i++) {
+        if (keys[i].is_location != kind) {
+          continue;
+        }
+
+        c = &mcf->stats_nodes[i]->counters;
+        for (reason = 1; reason < NGX_HTTP_BROTLI_SKIP_N; reason++) {
+          b->last = ngx_slprintf(b->last, b->end,
+                                 "brotli_%s_skip_%s_total{server=\"%V\"",
+                                 name, bytes ? "bytes" : "responses",
+                                 &keys[i].server_label);
+          if (kind) {
+            b->last = ngx_slprintf(b->last, b->end, ",location=\"%V\"",
+                                   &keys[i].location_label);
+          }
+          b->last = ngx_slprintf(
+              b->last, b->end, ",reason=\"%V\"} %uA\n",
+              &ngx_http_brotli_skip_reasons[reason],
+              bytes ? c->skip_bytes[reason] : c->skip_responses[reason]);
+        }
+      }
+    }
+  }
+
+  if (ngx_http_brotli_status_usage_prometheus(r, mcf, ll) != NGX_OK ||
+      ngx_http_brotli_status_tenants_prometheus(r, mcf, ll) != NGX_OK) {
+    return NGX_ERROR;
+  }
+
+  /* Histograms; each family has to be contiguous. */
+  for (hm = ngx_http_brotli_hist_metrics; hm->name; hm++) {
+    b = ngx_http_brotli_status_buf(r, ll, NGX_HTTP_BROTLI_STATS_METRIC_SIZE);
+    if (b == NULL) {
+      return NGX_ERROR;
+    }
+
+    b->last = ngx_slprintf(b->last, b->end,
+                           "# HELP brotli_%s %s\n"
+                           "# TYPE brotli_%s histogram\n",
+                           hm->name, hm->help, hm->name);
+
+    for (hn = hist; hn; hn = hn->next) {
+      if (ngx_http_brotli_hist_names(r, hn, &names,
+                                     ngx_http_brotli_escape_prometheus) !=
+          NGX_OK) {
+        return NGX_ERROR;
+      }
+
+      ngx_memcpy(&h, (u_char*)hn + hm->offset, sizeof(ngx_http_brotli_hist_t));
+
+      labels = names.server.len + names.location.len + names.type.len;
+      size = (NGX_HTTP_BROTLI_HIST_BUCKETS + 2) *
+             (NGX_HTTP_BROTLI_STATS_LINE_SIZE + labels);
+
+      b = ngx_http_brotli_status_buf(r, ll, size);
+      if (b == NULL) {
+        return NGX_ERROR;
+      }
+
+      /* All the buckets are reported, so that series are stable. */
+      cumulative = 0;
+      for (i = 0; i < NGX_HTTP_BROTLI_HIST_BUCKETS - 1; i++) {
+        cumulative += h.buckets[i];
+        b->last = ngx_slprintf(
+            b->last, b->end,
+            "brotli_%s_bucket{server=\"%V\",location=\"%V\",type=\"%V\",le=\"",
+            hm->name, &names.server, &names.location, &names.type);
+        b->last = ngx_http_brotli_hist_value(
+            b->last, b->end, ngx_http_brotli_hist_bucket_bound(i), hm->scale);
+        b->last = ngx_slprintf(b->last, b->end, "\"} %uA\n", cumulative);
+      }
+
+      b->last = ngx_slprintf(
+          b->last, b->end,
+          "brotli_%s_bucket{server=\"%V\",location=\"%V\",type=\"%V\","
+          "le=\"+Inf\"} %uA\n"
+          "brotli_%s_sum{server=\"%V\",location=\"%V\",type=\"%V\"} ",
+          hm->name, &names.server, &names.location, &names.type, h.count,
+          hm->name, &names.server, &names.location, &names.type);
+      b->last = ngx_http_brotli_hist_value(b->last, b->end, h.sum, hm->scale);
+      b->last = ngx_slprintf(
+          b->last, b->end,
+          "\n"
+          "brotli_%s_count{server=\"%V\",location=\"%V\",type=\"%V\"} %uA\n",
+          hm->name, &names.server, &names.location, &names.type, h.count);
+    }
+  }
+
+  return NGX_OK;
+}
+
+/* Reports statistics zone as JSON or, with "?format=prometheus", in
+   Prometheus text exposition format. */
+static ngx_int_t ngx_http_brotli_status_handler(ngx_http_request_t* r) {
+  ngx_http_brotli_main_conf_t* mcf;
+  ngx_http_brotli_hist_node_t* hist;
+  ngx_str_t format;
+  ngx_int_t rc;
+  ngx_uint_t prometheus;
+  ngx_chain_t* out;
+  ngx_chain_t** ll;
+  ngx_chain_t* cl;
+  off_t len;
+
+  if (!(r->method & (NGX_HTTP_GET | NGX_HTTP_HEAD))) {
+    return NGX_HTTP_NOT_ALLOWED;
+  }
+
+  rc = ngx_http_discard_request_body(r);
+  if (rc != NGX_OK) {
+    return rc;
+  }
+
+  mcf = ngx_http_get_module_main_conf(r, ngx_http_brotli_filter_module);
+
+  prometheus = ngx_http_arg(r, (u_char*)"format", 6, &format) == NGX_OK &&
+               format.len == 10 &&
+               ngx_strncmp(format.data, "prometheus", 10) == 0;
+
+  if (prometheus) {
+    ngx_str_set(&r->headers_out.content_type, "text/plain; version=0.0.4");
+  } else {
+    ngx_str_set(&r->headers_out.content_type, "application/json");
+  }
+  r->headers_out.content_type_len = r->headers_out.content_type.len;
+  r->headers_out.content_type_lowcase = NULL;
+
+  if (r->method == NGX_HTTP_HEAD) {
+    r->headers_out.status = NGX_HTTP_OK;
+    return ngx_http_send_header(r);
+  }
+
+  /* Nodes published later are not reported. */
+  hist = mcf->stats_sh->hist;
+  ngx_memory_barrier();
+
+  out = NULL;
+  ll = &out;
+
+  if (prometheus) {
+    rc = ngx_http_brotli_status_prometheus(r, mcf, &ll, hist);
+  } else {
+    rc = ngx_http_brotli_status_json(r, mcf, &ll, hist);
+  }
+
+  if (rc != NGX_OK) {
+    return NGX_HTTP_INTERNAL_SERVER_ERROR;
+  }
+
+  len = 0;
+  for (cl = out; cl; cl = cl->next) {
+    len += cl->buf->last - cl->buf->pos;
+    if (cl->next == NULL) {
+      cl->buf->last_buf = (r == r->main) ? 1 : 0;
+      cl->buf->last_in_chain = 1;
+    }
+  }
+
+  r->headers_out.status = NGX_HTTP_OK;
+  r->headers_out.content_length_n = len;
+
+  rc = ngx_http_send_header(r);
+  if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+    return rc;
+  }
+
+  return ngx_http_output_filter(r, out);
 }
@@ -0,0 +1,15 @@
+#!/bin/bash
+set -ex
+
+# Runs the performance gate against the commit that the built range starts from; see
+# script/bench/gate.sh. Only metrics that do not depend on the machine are
+# compared, and nothing is run unless filter/ or static/ changed.
+
+BASE=${TRAVIS_COMMIT_RANGE%%.*}
+
+if [ -z "$BASE" ] || ! git cat-file -e "$BASE^{commit}"; then
+  echo "No base commit to compare with, gate is skipped"
+  exit 0
+fi
+
+GATE_BASE=$BASE script/bench/gate.sh ci
@@ -37,6 +37,36 @@ expect_equal() {
   fi
 }
 
+# Prints "skipped" counter of location in status and count of responses
+# skipped for reason there.
+skip_counts() {
+  $CURL -o tmp/skip-status.json $SERVER/brotli_status
+  python3 -c '
+import json, sys
+for l in json.load(sys.stdin)["locations"]:
+  if l["location"] == sys.argv[1]:
+    print(l["skipped"], l["skip"].get(sys.argv[2], {}).get("responses", 0))
+' "$1" "$2" < tmp/skip-status.json
+}
+
+# Fetches URL with Accept-Encoding; expects the response to be passed through
+# for reason, accounted in location.
+expect_skip() {
+  location=$1
+  reason=$2
+  BEFORE=(`skip_counts $location $reason`)
+  $CURL -H "Accept-encoding: $3" -o tmp/skip-$reason.txt $SERVER$4
+  VARS=(`tail -n 1 $FILES/brotli.log`)
+  AFTER=(`skip_counts $location $reason`)
+  if [ "${VARS[7]}" = "$reason" ] &&
+     [ "${AFTER[0]}" -gt "${BEFORE[0]:-0}" ] &&
+     [ "${AFTER[1]}" -gt "${BEFORE[1]:-0}" ]; then
+    add_result "OK"
+  else
+    add_result "FAIL (skip reason $reason: ${VARS[7]}, ${BEFORE[*]} -> ${AFTER[*]})"
+  fi
+}
+
 expect_br_equal() {
   expected=$1
   actual_br=$2
@@ -120,6 +150,192 @@ echo "Test: A-E: 'b'"
 $CURL -H 'Accept-encoding: b' -o tmp/ae-13.txt $SERVER/small.html
 expect_equal $FILES/small.html tmp/ae-13.txt
 
+echo "Test: variables"
+$CURL -H 'Accept-encoding: br' -o tmp/vars.br $SERVER/small.txt
+expect_br_equal $FILES/small.txt tmp/vars
+VARS=(`tail -n 1 $FILES/brotli.log`)
+if [ "${VARS[0]}" = "`stat -c %s $FILES/small.txt`" ] &&
+   [ "${VARS[1]}" = "`stat -c %s tmp/vars.br`" ] &&
+   [ "${VARS[2]}" = "1" ]; then
+  add_result "OK"
+else
+  add_result "FAIL (variables)"
+fi
+
+echo "Test: variables in level and window"
+$CURL -H 'Accept-encoding: br' -o tmp/level.br "$SERVER/level/war-and-peace.txt?level=5&window=64k"
+expect_br_equal $FILES/war-and-peace.txt tmp/level
+VARS=(`tail -n 1 $FILES/brotli.log`)
+if [ "${VARS[2]}" = "5" ] && [ "${VARS[3]}" = "65536" ]; then
+  add_result "OK"
+else
+  add_result "FAIL (variables in level and window)"
+fi
+
+echo "Test: level by size"
+$CURL -H 'Accept-encoding: br' -o tmp/by-size-small.br $SERVER/by-size/small.txt
+expect_br_equal $FILES/small.txt tmp/by-size-small
+VARS=(`tail -n 1 $FILES/brotli.log`)
+if [ "${VARS[2]}" = "9" ]; then
+  add_result "OK"
+else
+  add_result "FAIL (level by size, small)"
+fi
+$CURL -H 'Accept-encoding: br' -o tmp/by-size-large.br $SERVER/by-size/war-and-peace.txt
+expect_br_equal $FILES/war-and-peace.txt tmp/by-size-large
+VARS=(`tail -n 1 $FILES/brotli.log`)
+if [ "${VARS[2]}" = "4" ]; then
+  add_result "OK"
+else
+  add_result "FAIL (level by size, large)"
+fi
+
+echo "Test: level overrides inherited tiers"
+$CURL -H 'Accept-encoding: br' -o tmp/tiers-level.br http://localhost:8082/small.txt
+expect_br_equal $FILES/small.txt tmp/tiers-level
+VARS=(`tail -n 1 $FILES/brotli.log`)
+if [ "${VARS[2]}" = "11" ]; then
+  add_result "OK"
+else
+  add_result "FAIL (level overrides tiers, ${VARS[2]})"
+fi
+$CURL -H 'Accept-encoding: br' -o tmp/tiers.br http://localhost:8082/tiers/small.txt
+expect_br_equal $FILES/small.txt tmp/tiers
+VARS=(`tail -n 1 $FILES/brotli.log`)
+if [ "${VARS[2]}" = "9" ]; then
+  add_result "OK"
+else
+  add_result "FAIL (inherited tiers, ${VARS[2]})"
+fi
+
+echo "Test: lookahead"
+$CURL -H 'Accept-encoding: br' -o tmp/lookahead-small.br $SERVER/lookahead/small.txt
+expect_br_equal $FILES/small.txt tmp/lookahead-small
+VARS=(`tail -n 1 $FILES/brotli.log`)
+if [ "${VARS[2]}" = "9" ]; then
+  add_result "OK"
+else
+  add_result "FAIL (lookahead, small)"
+fi
+$CURL -H 'Accept-encoding: br' -o tmp/lookahead-large.br $SERVER/lookahead/war-and-peace.txt
+expect_br_equal $FILES/war-and-peace.txt tmp/lookahead-large
+VARS=(`tail -n 1 $FILES/brotli.log`)
+if [ "${VARS[2]}" = "2" ]; then
+  add_result "OK"
+else
+  add_result "FAIL (lookahead, large)"
+fi
+
+echo "Test: block time"
+$CURL -H 'Accept-encoding: br' -o tmp/block-warn.br $SERVER/block-warn/war-and-peace.txt
+expect_br_equal $FILES/war-and-peace.txt tmp/block-warn
+VARS=(`tail -n 1 $FILES/brotli.log`)
+if [[ "${VARS[6]}" =~ ^[0-9]+\.[0-9]{6}$ ]] && [ "${VARS[6]}" != "0.000000" ]; then
+  add_result "OK"
+else
+  add_result "FAIL (block time variable)"
+fi
+if grep -q 'brotli encoder blocked for [0-9]*\.[0-9]*ms, uri: "/block-warn/war-and-peace.txt"' $FILES/block-warn.log; then
+  add_result "OK"
+else
+  add_result "FAIL (block warn)"
+fi
+
+echo "Test: tenant quota"
+$CURL -H 'Accept-encoding: br' -o tmp/quota-1.br $SERVER/quota/war-and-peace.txt
+expect_br_equal $FILES/war-and-peace.txt tmp/quota-1
+$CURL -H 'Accept-encoding: br' -o tmp/quota-2.br $SERVER/quota/war-and-peace.txt
+expect_br_equal $FILES/war-and-peace.txt tmp/quota-2
+VARS=(`tail -n 1 $FILES/brotli.log`)
+if [ "${VARS[2]}" = "1" ]; then
+  add_result "OK"
+else
+  add_result "FAIL (tenant quota, quality ${VARS[2]})"
+fi
+$CURL -o tmp/quota-status.json $SERVER/brotli_status
+if grep -q '{"tenant":"quota",[^}]*"degraded":[1-9]' tmp/quota-status.json; then
+  add_result "OK"
+else
+  add_result "FAIL (tenant quota, degraded)"
+fi
+
+echo "Test: skip reasons"
+expect_skip / accept_encoding gzip /small.txt
+expect_skip /min-length/ min_length br /min-length/small.txt
+expect_skip / type br /small.html
+expect_skip /encoded/ encoded br /encoded/small.txt
+
+echo "Test: client abort"
+WORKERS=`pgrep -f "nginx: worker process"`
+$CURL -H 'Accept-encoding: br' -o /dev/null --max-time 2 $SERVER/slow/war-and-peace.txt
+sleep 1
+if [ "`pgrep -f "nginx: worker process"`" = "$WORKERS" ] &&
+   $CURL -H 'Accept-encoding: br' -o /dev/null $SERVER/small.txt; then
+  add_result "OK"
+else
+  add_result "FAIL (client abort)"
+fi
+
+echo "Test: status"
+$CURL -o tmp/status.json $SERVER/brotli_status
+if grep -q '"location":"/","compressed":[1-9]' tmp/status.json; then
+  add_result "OK"
+else
+  add_result "FAIL (status)"
+fi
+if grep -q '"encoders":\[{"quality":1,"window":[0-9]*,"memory":0,' tmp/status.json; then
+  add_result "OK"
+else
+  add_result "FAIL (status, memory)"
+fi
+if grep -q '"accept_encoding":{"responses":[1-9]' tmp/status.json; then
+  add_result "OK"
+else
+  add_result "FAIL (status, skip reason)"
+fi
+if grep -q '"tenants":\[[^]]*{"tenant":"localhost","encoder_usec":[0-9]*,"window_encoder_usec":[0-9]*,"streams":[1-9]' tmp/status.json; then
+  add_result "OK"
+else
+  add_result "FAIL (status, tenant)"
+fi
+$CURL -o tmp/status.txt "$SERVER/brotli_status?format=prometheus"
+if grep -q '^brotli_server_responses_compressed_total{server="_"} [1-9]' tmp/status.txt; then
+  add_result "OK"
+else
+  add_result "FAIL (status, prometheus)"
+fi
+if grep -q '^brotli_response_size_bytes_count{server="_",location="/",type="text/plain"} [1-9]' tmp/status.txt; then
+  add_result "OK"
+else
+  add_result "FAIL (status, histogram)"
+fi
+if grep -q '^brotli_worker_slow_blocks_total{worker="0"} [1-9]' tmp/status.txt &&
+   grep '^brotli_worker_block_second_max_seconds{worker="0"} ' tmp/status.txt | grep -qv ' 0\.000000$'; then
+  add_result "OK"
+else
+  add_result "FAIL (status, blocked time)"
+fi
+# Every skip reason, escaped label.
+if grep -qF 'brotli_location_skip_responses_total{server="_",location="/quote\"d/",reason="subrequest"} 0' tmp/status.txt; then
+  add_result "OK"
+else
+  add_result "FAIL (status, prometheus labels)"
+fi
+# Full bucket set: 123 finite bounds and +Inf.
+if [ "`grep -c '^brotli_response_size_bytes_bucket{server="_",location="/",type="text/plain",le=' tmp/status.txt`" = "124" ]; then
+  add_result "OK"
+else
+  add_result "FAIL (status, histogram buckets)"
+fi
+
+echo "Test: event log"
+sleep 1
+if grep -q '"type":"text/plain","status":200,"ok":true,"bytes_in":[1-9]' $FILES/events.log; then
+  add_result "OK"
+else
+  add_result "FAIL (event log)"
+fi
+
 echo $HR
 echo "Stopping default NGINX"
 # Stop server.
@@ -129,6 +345,7 @@ $NGINX -c $ROOT/script/test.conf -s stop
 
 # Start default server.
 echo "Statring h2 NGINX"
+rm -f $FILES/events-h2.log $FILES/events-h2.log.br
 $NGINX -c $ROOT/script/test_h2.conf
 
 CURL="curl --http2-prior-knowledge -s"
@@ -148,6 +365,23 @@ echo "Test: A-E: 'b'"
 $CURL -H 'Accept-encoding: b' -o tmp/h2-ae-13.txt $SERVER/small.html
 expect_equal $FILES/small.html tmp/h2-ae-13.txt
 
+echo "Test: compressed event log"
+# Old worker flushes its events as it exits.
+$NGINX -c $ROOT/script/test_h2.conf -s reload
+sleep 1
+if python3 $ROOT/script/brcat.py $FILES/events-h2.log.br > tmp/events-h2.txt &&
+   python3 -c '
+import json, sys
+fields = ["status", "bytes_in", "bytes_out", "quality", "window"]
+events = [" ".join(str(json.loads(line)[f]) for f in fields)
+          for line in open(sys.argv[1])]
+sys.exit(not events or events != open(sys.argv[2]).read().splitlines())
+' tmp/events-h2.txt $FILES/events-h2.log; then
+  add_result "OK"
+else
+  add_result "FAIL (compressed event log)"
+fi
+
 echo $HR
 echo "Stopping h2 NGINX"
 # Stop server.
@@ -0,0 +1,45 @@
+#!/bin/bash
+set -e
+
+# Accept-Encoding parsers of the filter and static modules, and an optional
+# candidate, checked against each other.
+#
+#   script/bench/ae.sh bench          - time parsers on accept-encoding.txt,
+#                                       results in script/bench/out/ae.jsonl
+#   script/bench/ae.sh fuzz [args]    - differential fuzzing with libFuzzer
+#                                       (clang), for FUZZ_TIME seconds
+#
+# CANDIDATE=parser.c adds ngx_http_brotli_ae_candidate(), with the signature
+# of check_accept_encoding(), to both.
+
+. script/bench/common.sh
+
+FUZZ_TIME=${FUZZ_TIME:-60}
+
+if [ -n "$CANDIDATE" ]; then
+  CANDIDATE_FLAGS="-DNGX_HTTP_BROTLI_BENCH_CANDIDATE=1 `realpath $CANDIDATE`"
+fi
+
+case ${1:-bench} in
+  bench)
+    bench_build ae_bench $CANDIDATE_FLAGS
+    $OUT/ae_bench $BENCH/accept-encoding.txt > $OUT/ae.jsonl
+    echo "Results: `wc -l < $OUT/ae.jsonl` values in $OUT/ae.jsonl"
+    ;;
+  fuzz)
+    shift
+    BENCH_CC=${BENCH_CC:-clang} bench_build ae_fuzz \
+        -fsanitize=fuzzer,address $CANDIDATE_FLAGS
+
+    # Seeds are list entries, one per file.
+    mkdir -p $OUT/ae-corpus
+    grep -v '^# ' $BENCH/accept-encoding.txt | awk -v dir=$OUT/ae-corpus \
+        '{ printf "%s", $0 > (dir "/seed-" NR) }'
+
+    $OUT/ae_fuzz -max_total_time=$FUZZ_TIME -max_len=4096 "$@" $OUT/ae-corpus
+    ;;
+  *)
+    echo "usage: $0 bench | fuzz [libFuzzer options]" >&2
+    exit 2
+    ;;
+esac
@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) Google Inc.
+ */
+
+/*
+ * Accept-Encoding parser microbenchmark: times every parser on every header
+ * value of the list file and on generated adversarial values, and writes one
+ * JSON object per line for each value. Exits with an error if parsers
+ * disagree.
+ *
+ *   ae_bench <file>
+ */
+
+#include "ngx_http_brotli_bench_ae.h"
+
+#define NGX_HTTP_BROTLI_BENCH_BATCH 256
+#define NGX_HTTP_BROTLI_BENCH_MIN_NSEC 10000000
+#define NGX_HTTP_BROTLI_BENCH_SHOWN 48
+
+typedef struct {
+  const char* name;
+  const char* unit;
+  ngx_uint_t count;
+} ngx_http_brotli_bench_repeat_t;
+
+/* Long values, slow for naive substring search and token scanning. */
+static ngx_http_brotli_bench_repeat_t ngx_http_brotli_bench_repeats[] = {
+    {"repeat-b", "b", 4096},
+    {"repeat-br-", "br-", 1024},
+    {"repeat-bro", "bro", 1024},
+    {"repeat-br-q0", "br;q=0, ", 512},
+    {"repeat-gzip", "gzip;q=0.5, ", 256},
+    {"repeat-comma", ",", 4096},
+    {NULL, NULL, 0}};
+
+/* Sum of ns per call over all values, by parser. */
+static uint64_t ngx_http_brotli_bench_total[
+    sizeof(ngx_http_brotli_bench_parsers) /
+    sizeof(ngx_http_brotli_bench_parser_t)];
+
+static void ngx_http_brotli_bench_escape(ngx_str_t* s) {
+  size_t i;
+  u_char c;
+
+  for (i = 0; i < s->len && i < NGX_HTTP_BROTLI_BENCH_SHOWN; i++) {
+    c = s->data[i];
+    if (c == '"' || c == '\\') {
+      printf("\\%c", c);
+    } else if (c < 0x20 || c >= 0x7f) {
+      printf("\\u%04x", c);
+    } else {
+      putchar(c);
+    }
+  }
+
+  if (s->len > NGX_HTTP_BROTLI_BENCH_SHOWN) {
+    printf("...");
+  }
+}
+
+static ngx_int_t ngx_http_brotli_bench_value(ngx_http_request_t* r,
+                                             const char* name,
+                                             ngx_str_t* value) {
+  ngx_http_brotli_bench_parser_t* p;
+  ngx_table_elt_t h;
+  uint64_t start;
+  uint64_t nsec;
+  ngx_uint_t calls;
+  ngx_uint_t i;
+  ngx_int_t rc;
+
+  rc = ngx_http_brotli_bench_ae_check(r, value);
+  if (rc == NGX_ERROR) {
+    return NGX_ERROR;
+  }
+
+  ngx_memzero(&h, sizeof(ngx_table_elt_t));
+  h.value = *value;
+  r->headers_in.accept_encoding = &h;
+
+  printf("{\"name\":\"%s\",\"header\":\"", name);
+  ngx_http_brotli_bench_escape(value);
+  printf("\",\"length\":%zu,\"result\":\"%s\",\"ns\":{", value->len,
+         rc == NGX_OK ? "br" : "none");
+
+  for (p = ngx_http_brotli_bench_parsers; p->name; p++) {
+    calls = 0;
+    start = ngx_http_brotli_bench_nsec();
+
+    do {
+      for (i = 0; i < NGX_HTTP_BROTLI_BENCH_BATCH; i++) {
+        p->check(r);
+      }
+      calls += NGX_HTTP_BROTLI_BENCH_BATCH;
+      nsec = ngx_http_brotli_bench_nsec() - start;
+    } while (nsec < NGX_HTTP_BROTLI_BENCH_MIN_NSEC);
+
+    ngx_http_brotli_bench_total[p - ngx_http_brotli_bench_parsers] +=
+        nsec / calls;
+
+    printf("%s\"%s\":%.1f", p == ngx_http_brotli_bench_parsers ? "" : ",",
+           p->name, (double)nsec / calls);
+  }
+
+  printf("}}\n");
+  fflush(stdout);
+
+  r->headers_in.accept_encoding = NULL;
+
+  return NGX_OK;
+}
+
+int main(int argc, char** argv) {
+  ngx_http_brotli_bench_repeat_t* rp;
+  ngx_http_brotli_bench_parser_t* p;
+  ngx_http_brotli_bench_t b;
+  ngx_http_request_t* r;
+  ngx_str_t data;
+  ngx_str_t value;
+  ngx_uint_t values;
+  ngx_uint_t i;
+  u_char* line;
+  u_char* end;
+  u_char* v;
+  size_t len;
+  char name[32];
+
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s <file>\n", argv[0]);
+    return 2;
+  }
+
+  if (ngx_http_brotli_bench_init(&b) != NGX_OK ||
+      ngx_http_brotli_bench_read(&b, argv[1], &data) != NGX_OK) {
+    return 1;
+  }
+
+  r = ngx_http_brotli_bench_request(&b, -1);
+  if (r == NULL) {
+    return 1;
+  }
+
+  values = 0;
+
+  for (line = data.data; line < data.data + data.len; line = end + 1) {
+    end = ngx_strlchr(line, data.data + data.len, LF);
+    if (end == NULL) {
+      end = data.data + data.len;
+    }
+
+    if (end - line >= 2 && line[0] == '#' && line[1] == ' ') {
+      continue;
+    }
+
+    v = ngx_http_brotli_bench_ae_value(line, end - line, &value);
+    if (v == NULL) {
+      return 1;
+    }
+
+    ngx_sprintf((u_char*)name, "line-%ui%Z", (ngx_uint_t)++values);
+
+    if (ngx_http_brotli_bench_value(r, name, &value) != NGX_OK) {
+      return 1;
+    }
+
+    free(v);
+  }
+
+  for (rp = ngx_http_brotli_bench_repeats; rp->name; rp++) {
+    len = ngx_strlen(rp->unit);
+
+    line = ngx_palloc(b.pool, len * rp->count);
+    if (line == NULL) {
+      return 1;
+    }
+
+    for (i = 0; i < rp->count; i++) {
+      ngx_memcpy(line + i * len, rp->unit, len);
+    }
+
+    v = ngx_http_brotli_bench_ae_value(line, len * rp->count, &value);
+    if (v == NULL) {
+      return 1;
+    }
+
+    if (ngx_http_brotli_bench_value(r, rp->name, &value) != NGX_OK) {
+      return 1;
+    }
+
+    values++;
+    free(v);
+  }
+
+  printf("{\"name\":\"total\",\"values\":%u,\"ns\":{", (unsigned)values);
+  for (p = ngx_http_brotli_bench_parsers; p->name; p++) {
+    printf("%s\"%s\":%llu", p == ngx_http_brotli_bench_parsers ? "" : ",",
+           p->name, (unsigned long long)
+               ngx_http_brotli_bench_total[p - ngx_http_brotli_bench_parsers]);
+  }
+  printf("}}\n");
+
+  return 0;
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) Google Inc.
+ */
+
+/*
+ * libFuzzer target: Accept-Encoding parsers must agree on every header value;
+ * see script/bench/ae.sh.
+ */
+
+#include "ngx_http_brotli_bench_ae.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  static ngx_http_brotli_bench_t b;
+  static ngx_http_request_t* r;
+  ngx_str_t value;
+  ngx_int_t rc;
+  u_char* p;
+
+  if (r == NULL) {
+    if (ngx_http_brotli_bench_init(&b) != NGX_OK) {
+      abort();
+    }
+    r = ngx_http_brotli_bench_request(&b, -1);
+    if (r == NULL) {
+      abort();
+    }
+  }
+
+  p = ngx_http_brotli_bench_ae_value(data, size, &value);
+  if (p == NULL) {
+    return 0;
+  }
+
+  rc = ngx_http_brotli_bench_ae_check(r, &value);
+  free(p);
+
+  if (rc == NGX_ERROR) {
+    abort();
+  }
+
+  return 0;
+}
@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+"""Stand-in streaming backend of script/bench/latency.sh: writes events at
+steady pace, each stamped with CLOCK_MONOTONIC time in nanoseconds when it
+was written.
+
+  backend.py <port>
+
+  GET /<kind>?events=<n>&interval=<ms>&size=<bytes>
+
+Kinds are "sse" (text/event-stream), "ndjson" (application/x-ndjson) and
+"html" (text/html, as if page was generated slowly). Response has no length
+and ends when connection is closed.
+"""
+
+import asyncio
+import sys
+import time
+import urllib.parse
+
+TYPES = {"sse": "text/event-stream", "ndjson": "application/x-ndjson",
+         "html": "text/html"}
+
+FILLER = ("price order account search product review shipping delivery cart "
+          "checkout session profile settings message notification ") * 64
+
+
+def event(kind, seq, size):
+  t = time.monotonic_ns()
+  pad = FILLER[:max(0, size - 64)]
+  if kind == "sse":
+    return "data: {\"seq\":%d,\"t\":%d,\"pad\":\"%s\"}\n\n" % (seq, t, pad)
+  if kind == "ndjson":
+    return "{\"seq\":%d,\"t\":%d,\"pad\":\"%s\"}\n" % (seq, t, pad)
+  return "<div data-seq=\"%d\" data-t=\"%d\">%s</div>\n" % (seq, t, pad)
+
+
+async def handle(reader, writer):
+  request = (await reader.readline()).decode().split()
+  while (await reader.readline()).strip():
+    pass
+
+  url = urllib.parse.urlsplit(request[1])
+  kind = url.path.strip("/")
+  args = dict(urllib.parse.parse_qsl(url.query))
+  events = int(args.get("events", 100))
+  interval = int(args.get("interval", 50)) / 1000.0
+  size = int(args.get("size", 200))
+
+  if kind not in TYPES:
+    writer.write(b"HTTP/1.0 404 Not Found\r\nConnection: close\r\n\r\n")
+    writer.close()
+    return
+
+  writer.write(("HTTP/1.0 200 OK\r\nContent-Type: %s\r\n"
+                "Cache-Control: no-cache\r\nConnection: close\r\n\r\n"
+                % TYPES[kind]).encode())
+  if kind == "html":
+    writer.write(b"<!DOCTYPE html>\n<html>\n<body>\n")
+  await writer.drain()
+
+  start = time.monotonic()
+  for seq in range(events):
+    # Paced against start, so that slow writes do not shift schedule.
+    await asyncio.sleep(max(0, start + seq * interval - time.monotonic()))
+    writer.write(event(kind, seq, size).encode())
+    await writer.drain()
+
+  writer.close()
+
+
+async def main(port):
+  server = await asyncio.start_server(handle, "127.0.0.1", port)
+  async with server:
+    await server.serve_forever()
+
+
+if __name__ == "__main__":
+  asyncio.run(main(int(sys.argv[1])))
@@ -0,0 +1,84 @@
+# Shared by benchmark scripts; sourced from the repository root, after
+# script/.travis-compile.sh has built nginx.
+
+ROOT=`pwd`
+NGINX_DIR=$ROOT/nginx
+NGINX=$NGINX_DIR/objs/nginx
+BENCH=$ROOT/script/bench
+OUT=$BENCH/out
+
+mkdir -p $OUT
+
+# Builds script/bench/<name>.c into $OUT/<name>, with optional extra compiler
+# and linker flags. The filter module is compiled into the benchmark, the
+# static module is compiled in with ngx_http_brotli_bench_static.c, and both
+# are linked with the rest of nginx objects. BENCH_CC overrides compiler.
+bench_build() {
+  name=$1
+  shift
+  extra="$*"
+
+  (
+    cd $NGINX_DIR
+
+    cc=${BENCH_CC:-`sed -n 's/^CC =[ ]*//p' objs/Makefile`}
+    cflags=`sed -n 's/^CFLAGS =[ ]*//p' objs/Makefile`
+    incs=`sed -n '/^ALL_INCS = /,/^$/p' objs/Makefile \
+          | sed -e 's/^ALL_INCS = //' -e 's/\\\\$//' | tr '\n' ' '`
+    link=`sed -n '/$(LINK) -o objs\/nginx/,/^$/p' objs/Makefile \
+          | tail -n +2 | sed 's/\\\\$//' | tr '\n' ' '`
+
+    # Modules are compiled in, and main() belongs to the benchmark.
+    objcopy --redefine-sym main=ngx_http_brotli_bench_nginx_main \
+        objs/src/core/nginx.o $OUT/nginx.o
+    link=`echo $link | sed \
+        -e 's# objs/addon/filter/ngx_http_brotli_filter_module.o##' \
+        -e 's# objs/addon/static/ngx_http_brotli_static_module.o##' \
+        -e "s#objs/src/core/nginx.o#$OUT/nginx.o#"`
+
+    $cc $cflags -Wno-error $incs -I $BENCH -o $OUT/$name $BENCH/$name.c \
+        $BENCH/ngx_http_brotli_bench_static.c $extra $link
+  )
+}
+
+# Worker processes of running nginx.
+workers() {
+  pgrep -P `cat $OUT/nginx.pid`
+}
+
+# CPU time of workers, in clock ticks.
+cpu_ticks() {
+  local ticks=0
+  for pid in `workers`; do
+    set -- `sed 's/^.*) //' /proc/$pid/stat`
+    ticks=$((ticks + ${12} + ${13}))
+  done
+  echo $ticks
+}
+
+# Resident memory of workers, in kilobytes.
+rss_kb() {
+  local kb=0
+  for pid in `workers`; do
+    kb=$((kb + `awk '/^VmRSS/ { print $2 }' /proc/$pid/status`))
+  done
+  echo $kb
+}
+
+# Starts nginx with script/bench/load.conf, WORKERS workers, given quality
+# and window (4m by default).
+nginx_start() {
+  mkdir -p $OUT/logs
+  sed -e "s#@WORKERS@#${WORKERS:-1}#" -e "s#@QUALITY@#$1#" \
+      -e "s#@WINDOW@#${2:-4m}#" -e "s#@OUT@#$OUT#" \
+      $BENCH/load.conf > $OUT/load.conf
+  $NGINX -p $OUT/ -c $OUT/load.conf
+  sleep 1
+}
+
+nginx_stop() {
+  $NGINX -p $OUT/ -c $OUT/load.conf -s stop
+  while [ -f $OUT/nginx.pid ]; do
+    sleep 0.1
+  done
+}
@@ -0,0 +1,169 @@
+#!/usr/bin/env python3
+"""Writes benchmark corpus: HTML, CSS, JS, JSON, SVG and NDJSON documents of
+several sizes. Output depends only on the seed, so results of different
+revisions and machines are comparable.
+
+  corpus.py <directory>
+"""
+
+import json
+import os
+import random
+import sys
+
+SEED = 20190101
+SIZES = [("1k", 1 << 10), ("16k", 16 << 10), ("128k", 128 << 10),
+         ("1m", 1 << 20)]
+
+WORDS = ("the of and to in is that for it as was with be by on not he this "
+         "are or his from at which but have an they you were her she there "
+         "been one all we their has would when if so no will more can out "
+         "about time other into only some could them than then these two "
+         "may first any like now my such make over our even most state "
+         "after also made many did must before back see through way where "
+         "get much go well your know should down work year because come "
+         "people just say each those take day good how long little use "
+         "price order account search product review shipping delivery cart "
+         "checkout session profile settings message notification").split()
+
+TAGS = ["div", "span", "p", "a", "li", "section", "article", "h2", "em"]
+CLASSES = ["container", "row", "col-md-6", "card", "card-body", "btn",
+           "btn-primary", "nav-item", "active", "text-muted", "header",
+           "footer", "sidebar", "product-tile", "price", "rating"]
+PROPERTIES = ["color", "margin", "padding", "display", "font-size",
+              "line-height", "border", "background-color", "width", "height",
+              "flex", "position", "top", "left", "transition", "z-index"]
+IDENTIFIERS = ["element", "options", "state", "callback", "index", "value",
+               "result", "config", "event", "handler", "items", "node",
+               "request", "response", "data", "key", "count", "target"]
+
+
+def words(rnd, n):
+  return " ".join(rnd.choice(WORDS) for _ in range(n))
+
+
+def html(rnd):
+  yield "<!DOCTYPE html>\n<html lang=\"en\">\n<head>\n<meta charset=\"utf-8\">\n"
+  yield "<title>%s</title>\n</head>\n<body>\n" % words(rnd, 5)
+  while True:
+    tag = rnd.choice(TAGS)
+    classes = " ".join(rnd.sample(CLASSES, rnd.randint(1, 3)))
+    if tag == "a":
+      yield "<a class=\"%s\" href=\"/%s/%d\">%s</a>\n" % (
+          classes, rnd.choice(WORDS), rnd.randint(1, 99999), words(rnd, 3))
+    else:
+      yield "<%s class=\"%s\">%s</%s>\n" % (
+          tag, classes, words(rnd, rnd.randint(3, 40)), tag)
+
+
+def css(rnd):
+  while True:
+    selector = ", ".join(
+        ".%s %s" % (rnd.choice(CLASSES), rnd.choice(TAGS))
+        for _ in range(rnd.randint(1, 3)))
+    body = "".join(
+        "  %s: %s;\n" % (rnd.choice(PROPERTIES),
+                         rnd.choice(["%dpx" % rnd.randint(0, 64),
+                                     "#%06x" % rnd.randint(0, 0xffffff),
+                                     "auto", "none", "1.5", "100%",
+                                     "0 %dpx" % rnd.randint(0, 32)]))
+        for _ in range(rnd.randint(1, 8)))
+    yield "%s {\n%s}\n" % (selector, body)
+
+
+def js(rnd):
+  while True:
+    name = rnd.choice(IDENTIFIERS) + rnd.choice(IDENTIFIERS).capitalize()
+    args = ", ".join(rnd.sample(IDENTIFIERS, rnd.randint(0, 3)))
+    lines = []
+    for _ in range(rnd.randint(2, 10)):
+      a, b = rnd.sample(IDENTIFIERS, 2)
+      lines.append(rnd.choice([
+          "  const %s = %s.%s(%d);" % (a, b, rnd.choice(IDENTIFIERS),
+                                       rnd.randint(0, 100)),
+          "  if (%s === null) { return %s; }" % (a, b),
+          "  for (let i = 0; i < %s.length; i++) { %s += %s[i]; }" % (a, b, a),
+          "  %s.addEventListener('%s', %s);" % (a, rnd.choice(WORDS), b),
+          "  // %s" % words(rnd, 8)]))
+    yield "function %s(%s) {\n%s\n}\n\n" % (name, args, "\n".join(lines))
+
+
+def api_object(rnd):
+  return {
+      "id": rnd.randint(1, 1 << 31),
+      "name": words(rnd, 3),
+      "sku": "%s-%05d" % (rnd.choice(WORDS).upper(), rnd.randint(0, 99999)),
+      "price": round(rnd.uniform(1, 500), 2),
+      "currency": rnd.choice(["USD", "EUR", "GBP"]),
+      "in_stock": rnd.random() < 0.8,
+      "tags": rnd.sample(WORDS, rnd.randint(0, 4)),
+      "rating": {"average": round(rnd.uniform(1, 5), 1),
+                 "count": rnd.randint(0, 5000)},
+  }
+
+
+def json_(rnd):
+  yield "{\"items\":["
+  first = True
+  while True:
+    yield ("" if first else ",") + json.dumps(api_object(rnd))
+    first = False
+
+
+def svg(rnd):
+  yield ("<svg xmlns=\"http://www.w3.org/2000/svg\" viewBox=\"0 0 1024 1024\">"
+         "\n")
+  while True:
+    points = " ".join(
+        "%s%.2f %.2f" % (rnd.choice("LQC"), rnd.uniform(0, 1024),
+                         rnd.uniform(0, 1024))
+        for _ in range(rnd.randint(3, 12)))
+    yield "<path fill=\"#%06x\" d=\"M%.2f %.2f %sZ\"/>\n" % (
+        rnd.randint(0, 0xffffff), rnd.uniform(0, 1024), rnd.uniform(0, 1024),
+        points)
+
+
+def ndjson(rnd):
+  t = 1546300800.0
+  while True:
+    t += rnd.expovariate(50)
+    yield json.dumps({
+        "ts": round(t, 3),
+        "level": rnd.choice(["info", "info", "info", "warn", "error"]),
+        "service": rnd.choice(["api", "auth", "search", "checkout"]),
+        "status": rnd.choice([200, 200, 200, 204, 301, 404, 500]),
+        "latency_ms": round(rnd.lognormvariate(3, 1), 2),
+        "msg": words(rnd, rnd.randint(3, 12)),
+    }) + "\n"
+
+
+TYPES = [("html", "html", html), ("css", "css", css), ("js", "js", js),
+         ("json", "json", json_), ("svg", "svg", svg),
+         ("ndjson", "ndjson", ndjson)]
+
+
+def main():
+  if len(sys.argv) != 2:
+    sys.exit(__doc__)
+
+  directory = sys.argv[1]
+  os.makedirs(directory, exist_ok=True)
+
+  for name, ext, generate in TYPES:
+    for label, size in SIZES:
+      rnd = random.Random("%d-%s-%s" % (SEED, name, label))
+      chunks = []
+      length = 0
+      for chunk in generate(rnd):
+        chunks.append(chunk)
+        length += len(chunk)
+        if length >= size:
+          break
+      data = "".join(chunks).encode("utf-8")[:size]
+      with open(os.path.join(directory, "%s-%s.%s" % (name, label, ext)),
+                "wb") as f:
+        f.write(data)
+
+
+if __name__ == "__main__":
+  main()
@@ -0,0 +1,21 @@
+#!/bin/bash
+set -e
+
+# Compression corpus benchmark: MB/s, ratio and peak encoder memory of every
+# corpus file, for every quality and window. Results are written to
+# script/bench/out/corpus.jsonl, one JSON object per line.
+#
+# QUALITIES and WINDOWS narrow the matrix, e.g.
+#   QUALITIES=4-6 WINDOWS=18-22 script/bench/corpus.sh
+
+. script/bench/common.sh
+
+QUALITIES=${QUALITIES:-0-11}
+WINDOWS=${WINDOWS:-10-24}
+
+python3 $BENCH/corpus.py $OUT/corpus
+bench_build corpus_bench
+
+$OUT/corpus_bench $QUALITIES $WINDOWS $OUT/corpus/* > $OUT/corpus.jsonl
+
+echo "Results: `wc -l < $OUT/corpus.jsonl` combinations in $OUT/corpus.jsonl"
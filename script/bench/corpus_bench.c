@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) Google Inc.
+ */
+
+/*
+ * Compresses every file with every quality and window, through the encoder
+ * set-up of the filter; writes one JSON object per line for each combination.
+ *
+ *   corpus_bench <qualities> <windows> <file>...
+ *
+ * Qualities and windows are "min-max" ranges. Response size is known, as for
+ * static files, so the filter may shrink the window; combinations that end up
+ * with the same window are measured once.
+ */
+
+#include "ngx_http_brotli_bench.h"
+
+/* Each combination is compressed at least this many times, and for at least
+   this long. */
+#define NGX_HTTP_BROTLI_BENCH_MIN_RUNS 3
+#define NGX_HTTP_BROTLI_BENCH_MIN_NSEC 200000000
+
+typedef struct {
+  size_t bytes_out;
+  size_t peak_memory;
+  uint64_t encoder_usec;
+  uint64_t nsec;
+  ngx_uint_t runs;
+} ngx_http_brotli_bench_result_t;
+
+/* Returns window the filter would use for data; 0 on failure. */
+static size_t ngx_http_brotli_bench_window(ngx_http_brotli_bench_t* b,
+                                           ngx_str_t* data) {
+  ngx_http_brotli_ctx_t* ctx;
+  ngx_http_request_t* r;
+  size_t lg_win;
+
+  r = ngx_http_brotli_bench_request(b, data->len);
+  if (r == NULL) {
+    return 0;
+  }
+
+  ctx = ngx_http_get_module_ctx(r, ngx_http_brotli_filter_module);
+  lg_win = ngx_http_brotli_filter_ensure_stream_initialized(r, ctx) == NGX_OK
+               ? ctx->lg_win
+               : 0;
+
+  ngx_http_brotli_bench_free_request(r);
+
+  return lg_win;
+}
+
+static ngx_int_t ngx_http_brotli_bench_compress(
+    ngx_http_brotli_bench_t* b, ngx_str_t* data,
+    ngx_http_brotli_bench_result_t* res) {
+  ngx_http_brotli_ctx_t* ctx;
+  ngx_http_request_t* r;
+  const uint8_t* next;
+  size_t available;
+  size_t size;
+  uint64_t start;
+
+  r = ngx_http_brotli_bench_request(b, data->len);
+  if (r == NULL) {
+    return NGX_ERROR;
+  }
+
+  ctx = ngx_http_get_module_ctx(r, ngx_http_brotli_filter_module);
+
+  start = ngx_http_brotli_bench_nsec();
+
+  if (ngx_http_brotli_filter_ensure_stream_initialized(r, ctx) != NGX_OK) {
+    goto failed;
+  }
+
+  next = data->data;
+  available = data->len;
+  res->bytes_out = 0;
+
+  for (;;) {
+    if (!ngx_http_brotli_filter_compress(ctx, BROTLI_OPERATION_FINISH,
+                                         &available, &next)) {
+      goto failed;
+    }
+
+    size = 0;
+    (void)BrotliEncoderTakeOutput(ctx->encoder, &size);
+    res->bytes_out += size;
+
+    if (BrotliEncoderIsFinished(ctx->encoder)) {
+      break;
+    }
+  }
+
+  ngx_http_brotli_filter_close(ctx);
+
+  res->nsec += ngx_http_brotli_bench_nsec() - start;
+  res->encoder_usec += ctx->encoder_usec;
+  res->peak_memory = ctx->peak_memory;
+  res->runs++;
+
+  ngx_http_brotli_bench_free_request(r);
+
+  return NGX_OK;
+
+failed:
+
+  ngx_http_brotli_bench_free_request(r);
+
+  return NGX_ERROR;
+}
+
+int main(int argc, char** argv) {
+  ngx_http_brotli_bench_result_t results[BROTLI_MAX_WINDOW_BITS + 1];
+  ngx_http_brotli_bench_result_t* res;
+  ngx_http_brotli_bench_t b;
+  ngx_uint_t quality, qmin, qmax;
+  ngx_uint_t window, wmin, wmax;
+  const char* name;
+  ngx_str_t data;
+  size_t lg_win;
+  double mb;
+  int i;
+
+  if (argc < 4 ||
+      ngx_http_brotli_bench_range(argv[1], &qmin, &qmax) != NGX_OK ||
+      ngx_http_brotli_bench_range(argv[2], &wmin, &wmax) != NGX_OK ||
+      qmax > BROTLI_MAX_QUALITY || wmin < BROTLI_MIN_WINDOW_BITS ||
+      wmax > BROTLI_MAX_WINDOW_BITS) {
+    fprintf(stderr, "usage: %s <qualities> <windows> <file>...\n", argv[0]);
+    return 2;
+  }
+
+  if (ngx_http_brotli_bench_init(&b) != NGX_OK) {
+    return 1;
+  }
+
+  for (i = 3; i < argc; i++) {
+    if (ngx_http_brotli_bench_read(&b, argv[i], &data) != NGX_OK) {
+      return 1;
+    }
+
+    name = strrchr(argv[i], '/');
+    name = name ? name + 1 : argv[i];
+    mb = (double)data.len / (1024 * 1024);
+
+    for (quality = qmin; quality <= qmax; quality++) {
+      ngx_memzero(results, sizeof(results));
+      b.conf->quality = quality;
+
+      for (window = wmin; window <= wmax; window++) {
+        b.conf->lg_win = window;
+
+        lg_win = ngx_http_brotli_bench_window(&b, &data);
+        if (lg_win == 0) {
+          fprintf(stderr, "%s: stream init failed\n", name);
+          return 1;
+        }
+
+        res = &results[lg_win];
+        while (res->runs < NGX_HTTP_BROTLI_BENCH_MIN_RUNS ||
+               res->nsec < NGX_HTTP_BROTLI_BENCH_MIN_NSEC) {
+          if (ngx_http_brotli_bench_compress(&b, &data, res) != NGX_OK) {
+            fprintf(stderr, "%s: compression failed\n", name);
+            return 1;
+          }
+        }
+
+        printf("{\"file\":\"%s\",\"size\":%zu,\"quality\":%u,"
+               "\"window\":%u,\"effective_window\":%zu,\"bytes_out\":%zu,"
+               "\"ratio\":%.4f,\"mb_s\":%.2f,\"cpu_mb_s\":%.2f,"
+               "\"peak_memory\":%zu,\"runs\":%u}\n",
+               name, data.len, (unsigned)quality, (unsigned)window, lg_win,
+               res->bytes_out,
+               res->bytes_out ? (double)data.len / res->bytes_out : 0.0,
+               mb * res->runs * 1e9 / res->nsec,
+               res->encoder_usec
+                   ? mb * res->runs * 1e6 / res->encoder_usec
+                   : 0.0,
+               res->peak_memory, (unsigned)res->runs);
+        fflush(stdout);
+      }
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,20 @@
+#!/bin/bash
+set -e
+
+# Body filter microbenchmark: calls, encoder allocations, pool usage and time
+# per byte for synthetic chain shapes and a slow mock client. Results are
+# written to script/bench/out/filter.jsonl, one JSON object per line.
+#
+#   QUALITY=6 FILES="html-1m.html json-128k.json" script/bench/filter.sh
+
+. script/bench/common.sh
+
+QUALITY=${QUALITY:-6}
+FILES=${FILES:-"html-16k.html html-1m.html json-128k.json ndjson-1m.ndjson"}
+
+python3 $BENCH/corpus.py $OUT/corpus
+bench_build filter_bench -Wl,--wrap=BrotliEncoderCreateInstance -lbrotlidec
+
+(cd $OUT/corpus && $OUT/filter_bench $QUALITY $FILES) > $OUT/filter.jsonl
+
+echo "Results: `wc -l < $OUT/filter.jsonl` runs in $OUT/filter.jsonl"
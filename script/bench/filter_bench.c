@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) Google Inc.
+ */
+
+/*
+ * Body filter microbenchmark: streams every file through
+ * ngx_http_brotli_body_filter() in several chain shapes, to a mock client,
+ * and writes one JSON object per line for each shape: filter and next filter
+ * calls, NGX_AGAIN returns, encoder allocations, request pool usage and
+ * time per input byte. Output of the first run is decoded and checked.
+ *
+ *   filter_bench <quality> <file>...
+ *
+ * Response size is unknown, as for proxied responses. Link with
+ * -Wl,--wrap=BrotliEncoderCreateInstance and -lbrotlidec.
+ */
+
+#include "ngx_http_brotli_bench.h"
+
+#include <brotli/decode.h>
+
+#define NGX_HTTP_BROTLI_BENCH_MIN_RUNS 5
+#define NGX_HTTP_BROTLI_BENCH_MIN_NSEC 200000000
+
+typedef struct {
+  const char* name;
+  ngx_http_brotli_bench_shape_t shape;
+  /* Client bytes per call; 0 - unlimited. */
+  size_t rate;
+} ngx_http_brotli_bench_case_t;
+
+static ngx_http_brotli_bench_case_t ngx_http_brotli_bench_cases[] = {
+    {"single", {0, 1, 0}, 0},
+    {"chunks-16k", {16384, 1, 0}, 0},
+    {"chunks-4k-batched", {4096, 16, 0}, 0},
+    {"tiny-64", {64, 1, 0}, 0},
+    {"tiny-64-batched", {64, 64, 0}, 0},
+    {"flush-4k", {4096, 1, 4096}, 0},
+    {"flush-256", {256, 1, 256}, 0},
+    {"slow-client", {16384, 1, 0}, 1460},
+    {"slow-client-tiny", {64, 1, 0}, 1460},
+    {NULL, {0, 0, 0}, 0}};
+
+/* Encoder allocations, counted on the way to the filter allocator. */
+static ngx_uint_t ngx_http_brotli_bench_allocs;
+static brotli_alloc_func ngx_http_brotli_bench_alloc_func;
+
+BrotliEncoderState* __real_BrotliEncoderCreateInstance(brotli_alloc_func alloc,
+                                                       brotli_free_func free,
+                                                       void* opaque);
+
+static void* ngx_http_brotli_bench_alloc(void* opaque, size_t size) {
+  ngx_http_brotli_bench_allocs++;
+  return ngx_http_brotli_bench_alloc_func(opaque, size);
+}
+
+BrotliEncoderState* __wrap_BrotliEncoderCreateInstance(brotli_alloc_func alloc,
+                                                       brotli_free_func free,
+                                                       void* opaque) {
+  ngx_http_brotli_bench_alloc_func = alloc;
+  return __real_BrotliEncoderCreateInstance(ngx_http_brotli_bench_alloc, free,
+                                            opaque);
+}
+
+typedef struct {
+  ngx_uint_t runs;
+  uint64_t nsec;
+  ngx_uint_t calls;
+  ngx_uint_t next_calls;
+  ngx_uint_t again;
+  ngx_uint_t allocs;
+  size_t pool_bytes;
+  size_t bytes_out;
+} ngx_http_brotli_bench_stats_t;
+
+static ngx_int_t ngx_http_brotli_bench_check(ngx_str_t* data,
+                                             ngx_http_brotli_bench_client_t* c) {
+  BrotliDecoderResult rc;
+  u_char* decoded;
+  size_t size;
+
+  size = data->len;
+  decoded = malloc(size + 1);
+  if (decoded == NULL) {
+    return NGX_ERROR;
+  }
+
+  rc = BrotliDecoderDecompress(c->len, c->data, &size, decoded);
+  if (rc != BROTLI_DECODER_RESULT_SUCCESS || size != data->len ||
+      ngx_memcmp(decoded, data->data, size) != 0 || c->last_buf != 1) {
+    free(decoded);
+    return NGX_ERROR;
+  }
+
+  free(decoded);
+
+  return NGX_OK;
+}
+
+static ngx_int_t ngx_http_brotli_bench_run(ngx_http_brotli_bench_t* b,
+                                           ngx_str_t* data,
+                                           ngx_http_brotli_bench_case_t* bc,
+                                           ngx_http_brotli_bench_stats_t* st) {
+  ngx_http_brotli_bench_client_t client;
+  ngx_http_request_t* r;
+  ngx_pool_t* upstream;
+  ngx_uint_t large;
+  ngx_uint_t calls;
+  ngx_int_t rc;
+  uint64_t start;
+  size_t bytes;
+
+  r = ngx_http_brotli_bench_request(b, -1);
+  upstream = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, &b->log);
+  if (r == NULL || upstream == NULL) {
+    return NGX_ERROR;
+  }
+
+  ngx_memzero(&client, sizeof(ngx_http_brotli_bench_client_t));
+  client.rate = bc->rate;
+  client.keep = (st->runs == 0);
+
+  ngx_http_brotli_bench_allocs = 0;
+  calls = 0;
+
+  start = ngx_http_brotli_bench_nsec();
+  rc = ngx_http_brotli_bench_stream(r, upstream, data, &bc->shape, &client,
+                                    &calls);
+  st->nsec += ngx_http_brotli_bench_nsec() - start;
+
+  if (rc == NGX_OK && client.keep) {
+    rc = ngx_http_brotli_bench_check(data, &client);
+    if (rc != NGX_OK) {
+      fprintf(stderr, "%s: output does not decode to input\n", bc->name);
+    }
+  }
+
+  ngx_http_brotli_bench_pool_usage(r->pool, &bytes, &large);
+
+  st->runs++;
+  st->calls += calls;
+  st->next_calls += client.calls;
+  st->again += client.again;
+  st->allocs += ngx_http_brotli_bench_allocs;
+  st->pool_bytes += bytes;
+  st->bytes_out = client.bytes;
+
+  free(client.data);
+  ngx_destroy_pool(upstream);
+  ngx_http_brotli_bench_free_request(r);
+
+  return rc;
+}
+
+int main(int argc, char** argv) {
+  ngx_http_brotli_bench_case_t* bc;
+  ngx_http_brotli_bench_stats_t st;
+  ngx_http_brotli_bench_t b;
+  const char* name;
+  ngx_str_t data;
+  ngx_int_t quality;
+  int i;
+
+  quality = (argc > 2) ? ngx_atoi((u_char*)argv[1], ngx_strlen(argv[1]))
+                       : NGX_ERROR;
+  if (quality < BROTLI_MIN_QUALITY || quality > BROTLI_MAX_QUALITY) {
+    fprintf(stderr, "usage: %s <quality> <file>...\n", argv[0]);
+    return 2;
+  }
+
+  if (ngx_http_brotli_bench_init(&b) != NGX_OK) {
+    return 1;
+  }
+  b.conf->quality = quality;
+
+  for (i = 2; i < argc; i++) {
+    if (ngx_http_brotli_bench_read(&b, argv[i], &data) != NGX_OK) {
+      return 1;
+    }
+
+    name = strrchr(argv[i], '/');
+    name = name ? name + 1 : argv[i];
+
+    for (bc = ngx_http_brotli_bench_cases; bc->name; bc++) {
+      ngx_memzero(&st, sizeof(ngx_http_brotli_bench_stats_t));
+
+      while (st.runs < NGX_HTTP_BROTLI_BENCH_MIN_RUNS ||
+             st.nsec < NGX_HTTP_BROTLI_BENCH_MIN_NSEC) {
+        if (ngx_http_brotli_bench_run(&b, &data, bc, &st) != NGX_OK) {
+          fprintf(stderr, "%s, %s: failed\n", name, bc->name);
+          return 1;
+        }
+      }
+
+      printf("{\"file\":\"%s\",\"shape\":\"%s\",\"quality\":%d,"
+             "\"bytes_in\":%zu,\"bytes_out\":%zu,\"calls\":%.1f,"
+             "\"next_calls\":%.1f,\"again\":%.1f,\"encoder_allocs\":%.1f,"
+             "\"pool_bytes\":%zu,\"ns_per_byte\":%.3f,\"runs\":%u}\n",
+             name, bc->name, (int)quality, data.len, st.bytes_out,
+             (double)st.calls / st.runs, (double)st.next_calls / st.runs,
+             (double)st.again / st.runs, (double)st.allocs / st.runs,
+             st.pool_bytes / st.runs,
+             data.len ? (double)st.nsec / st.runs / data.len : 0.0,
+             (unsigned)st.runs);
+      fflush(stdout);
+    }
+  }
+
+  return 0;
+}
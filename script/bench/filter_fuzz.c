@@ -0,0 +1,307 @@
+/*
+ * Copyright (C) Google Inc.
+ */
+
+/*
+ * libFuzzer target for body filter state machine; see
+ * script/bench/filter_fuzz.sh.
+ *
+ * Input is a program: header bytes choose quality, window, body and whether
+ * its length is known; every following op adds a buffer (data, empty, with or
+ * without flush) to the next chain, calls the filter with that chain or with
+ * nothing, as write event would, or changes how the mock client behaves:
+ * bytes taken per call, blocked calls, NGX_OK with data left. Once ops run
+ * out, the rest of body is passed with last_buf, and the filter is called
+ * until response is complete.
+ *
+ * Aborts if output does not decode to body, on filter error, if a call after
+ * last_buf makes no progress (stall), if one call hands output to the client
+ * too many times (spin), or if the filter holds data and the client nothing,
+ * while r->connection->buffered does not say so (truncated response).
+ */
+
+#include "ngx_http_brotli_bench.h"
+
+#include <brotli/decode.h>
+
+/* Next filter calls within one body filter call, that count as spin. */
+#define NGX_HTTP_BROTLI_FUZZ_SPIN 100000
+/* Body filter calls after last_buf, that count as hang. */
+#define NGX_HTTP_BROTLI_FUZZ_DRAIN 100000
+
+typedef struct {
+  const uint8_t* data;
+  size_t size;
+} ngx_http_brotli_fuzz_input_t;
+
+static const char* ngx_http_brotli_fuzz_words[] = {
+    "<div class=\"row\">", "</div>\n", "{\"id\":", "\"name\":\"", "\",",
+    "function(", ") {\n", "return ", "the ", "price ", "order ", "\n"};
+
+static ngx_http_brotli_bench_t ngx_http_brotli_fuzz_bench;
+static ngx_http_brotli_bench_client_t ngx_http_brotli_fuzz_client;
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+static ngx_uint_t ngx_http_brotli_fuzz_byte(ngx_http_brotli_fuzz_input_t* in) {
+  if (in->size == 0) {
+    return 0;
+  }
+  in->size--;
+  return *in->data++;
+}
+
+/* Compressible body: words and random bytes, from xorshift of seed. */
+static void ngx_http_brotli_fuzz_body(ngx_str_t* body, uint32_t seed) {
+  const char* word;
+  size_t len;
+  u_char* p;
+
+  seed |= 1;
+
+  for (p = body->data; p < body->data + body->len; p += len) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+
+    if (seed % 4 == 0) {
+      *p = (u_char)(seed >> 8);
+      len = 1;
+      continue;
+    }
+
+    word = ngx_http_brotli_fuzz_words[(seed >> 8) %
+                                      (sizeof(ngx_http_brotli_fuzz_words) /
+                                       sizeof(char*))];
+    len = ngx_min(ngx_strlen(word), (size_t)(body->data + body->len - p));
+    ngx_memcpy(p, word, len);
+  }
+}
+
+static ngx_chain_t* ngx_http_brotli_fuzz_buf(ngx_pool_t* pool,
+                                             ngx_chain_t*** ll, u_char* pos,
+                                             size_t size) {
+  ngx_chain_t* cl;
+  ngx_buf_t* buf;
+
+  buf = ngx_calloc_buf(pool);
+  cl = ngx_alloc_chain_link(pool);
+  if (buf == NULL || cl == NULL) {
+    abort();
+  }
+
+  buf->pos = pos;
+  buf->last = pos + size;
+  buf->start = buf->pos;
+  buf->end = buf->last;
+  buf->memory = size ? 1 : 0;
+
+  cl->buf = buf;
+  cl->next = NULL;
+  **ll = cl;
+  *ll = &cl->next;
+
+  return cl;
+}
+
+static void ngx_http_brotli_fuzz_check(ngx_str_t* body,
+                                       ngx_http_brotli_bench_client_t* c) {
+  BrotliDecoderResult rc;
+  u_char* decoded;
+  size_t size;
+
+  decoded = malloc(body->len + 1);
+  if (decoded == NULL) {
+    abort();
+  }
+
+  size = body->len + 1;
+  rc = BrotliDecoderDecompress(c->len, c->data, &size, decoded);
+
+  if (rc != BROTLI_DECODER_RESULT_SUCCESS || size != body->len ||
+      ngx_memcmp(decoded, body->data, size) != 0) {
+    fprintf(stderr, "output does not decode to body of %zu bytes\n",
+            body->len);
+    abort();
+  }
+
+  free(decoded);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  ngx_http_brotli_bench_client_t* c = &ngx_http_brotli_fuzz_client;
+  ngx_http_brotli_bench_t* b = &ngx_http_brotli_fuzz_bench;
+  ngx_http_brotli_fuzz_input_t in;
+  ngx_http_brotli_ctx_t* ctx;
+  ngx_http_request_t* r;
+  ngx_chain_t* chain;
+  ngx_chain_t** ll;
+  ngx_chain_t* cl;
+  ngx_uint_t last_buf;
+  ngx_uint_t drain;
+  ngx_uint_t calls;
+  ngx_uint_t op;
+  ngx_uint_t blocked;
+  ngx_int_t rc;
+  ngx_str_t body;
+  size_t bytes_in;
+  size_t bytes;
+  size_t len;
+  size_t pos;
+  uint32_t seed;
+
+  if (b->pool == NULL && ngx_http_brotli_bench_init(b) != NGX_OK) {
+    abort();
+  }
+
+  in.data = data;
+  in.size = size;
+
+  b->conf->quality = ngx_http_brotli_fuzz_byte(&in) % (BROTLI_MAX_QUALITY + 1);
+  b->conf->lg_win = BROTLI_MIN_WINDOW_BITS +
+                    ngx_http_brotli_fuzz_byte(&in) %
+                        (BROTLI_MAX_WINDOW_BITS - BROTLI_MIN_WINDOW_BITS + 1);
+
+  op = ngx_http_brotli_fuzz_byte(&in);
+  body.len = (op >> 1) << 8 | ngx_http_brotli_fuzz_byte(&in);
+  seed = ngx_http_brotli_fuzz_byte(&in) << 8 | ngx_http_brotli_fuzz_byte(&in);
+
+  body.data = malloc(body.len + 1);
+  if (body.data == NULL) {
+    abort();
+  }
+  ngx_http_brotli_fuzz_body(&body, seed);
+
+  r = ngx_http_brotli_bench_request(b, (op & 1) ? (off_t)body.len : -1);
+  if (r == NULL) {
+    abort();
+  }
+  ctx = ngx_http_get_module_ctx(r, ngx_http_brotli_filter_module);
+
+  ngx_memzero(c, sizeof(ngx_http_brotli_bench_client_t));
+  c->keep = 1;
+  ngx_http_brotli_bench_client = c;
+  ngx_http_next_body_filter = ngx_http_brotli_bench_next;
+
+  chain = NULL;
+  ll = &chain;
+  pos = 0;
+  last_buf = 0;
+  drain = 0;
+
+  for (;;) {
+    if (in.size) {
+      op = ngx_http_brotli_fuzz_byte(&in);
+
+      switch (op & 7) {
+        case 0:
+        case 1:
+        case 2:
+          /* Data; flushed, for 2. */
+          len = (ngx_http_brotli_fuzz_byte(&in) + 1) << ((op >> 3) & 7);
+          len = ngx_min(len, body.len - pos);
+          cl = ngx_http_brotli_fuzz_buf(r->pool, &ll, body.data + pos, len);
+          cl->buf->flush = (op & 7) == 2;
+          pos += len;
+          continue;
+        case 3:
+        case 4:
+          /* Empty buffer; flushed, for 4. */
+          cl = ngx_http_brotli_fuzz_buf(r->pool, &ll, body.data + pos, 0);
+          cl->buf->flush = (op & 7) == 4;
+          continue;
+        case 5:
+          /* Client: bytes per call, blocked calls and laziness. */
+          c->rate = ngx_http_brotli_fuzz_byte(&in) << ((op >> 3) & 3);
+          c->blocked = (op >> 5) & 3;
+          c->lazy = (op >> 7) & 1;
+          continue;
+        default:
+          /* Call, with chain so far (6) or nothing (7). */
+          if ((op & 7) == 7 && chain) {
+            continue;
+          }
+          break;
+      }
+
+    } else if (!last_buf) {
+      /* Rest of body, and last_buf. */
+      cl = ngx_http_brotli_fuzz_buf(r->pool, &ll, body.data + pos,
+                                    body.len - pos);
+      cl->buf->last_buf = 1;
+      pos = body.len;
+
+    } else {
+      /* Write events, as from a well-behaved client, until done. */
+      c->rate = 0;
+      c->blocked = 0;
+      c->lazy = 0;
+
+      if (ctx->closed && c->npending == 0) {
+        break;
+      }
+
+      if (++drain > NGX_HTTP_BROTLI_FUZZ_DRAIN) {
+        fprintf(stderr, "hang: no end after %u calls\n", (unsigned)drain);
+        abort();
+      }
+    }
+
+    for (cl = chain; cl; cl = cl->next) {
+      if (cl->buf->last_buf) {
+        last_buf = 1;
+      }
+    }
+
+    calls = c->calls;
+    blocked = c->blocked;
+    bytes = c->bytes;
+    bytes_in = ctx->bytes_in;
+
+    rc = ngx_http_brotli_body_filter(r, chain);
+
+    chain = NULL;
+    ll = &chain;
+
+    if (rc == NGX_ERROR) {
+      fprintf(stderr, "filter error\n");
+      abort();
+    }
+
+    if (c->calls - calls > NGX_HTTP_BROTLI_FUZZ_SPIN) {
+      fprintf(stderr, "spin: %u next filter calls in one call\n",
+              (unsigned)(c->calls - calls));
+      abort();
+    }
+
+    if (!last_buf) {
+      continue;
+    }
+
+    if (!ctx->closed && c->npending == 0 &&
+        !(r->connection->buffered & NGX_HTTP_BROTLI_BUFFERED)) {
+      fprintf(stderr, "truncated: filter holds data, but is not buffered\n");
+      abort();
+    }
+
+    if (blocked == 0 && !ctx->closed && c->bytes == bytes &&
+        ctx->bytes_in == bytes_in) {
+      fprintf(stderr, "stall: %zu of %zu bytes in, %zu bytes out\n",
+              ctx->bytes_in, body.len, c->bytes);
+      abort();
+    }
+  }
+
+  if (!ctx->success || c->last_buf != 1) {
+    fprintf(stderr, "response is not complete\n");
+    abort();
+  }
+
+  ngx_http_brotli_fuzz_check(&body, c);
+
+  free(c->data);
+  free(body.data);
+  ngx_http_brotli_bench_free_request(r);
+
+  return 0;
+}
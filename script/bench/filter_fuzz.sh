@@ -0,0 +1,21 @@
+#!/bin/bash
+set -e
+
+# Structure-aware fuzzing of the body filter state machine with libFuzzer
+# (clang, AddressSanitizer): arbitrary chains, flushes and empty buffers, and
+# clients that take part of output, block or return NGX_OK with data left.
+# Output must decode to input, without stalls or spins. Runs for FUZZ_TIME
+# seconds (60 by default); crashes are left in script/bench/out.
+#
+#   FUZZ_TIME=600 script/bench/filter_fuzz.sh [libFuzzer options]
+
+. script/bench/common.sh
+
+FUZZ_TIME=${FUZZ_TIME:-60}
+
+BENCH_CC=${BENCH_CC:-clang} bench_build filter_fuzz \
+    -fsanitize=fuzzer,address -lbrotlidec
+
+mkdir -p $OUT/filter-corpus
+(cd $OUT && ./filter_fuzz -max_total_time=$FUZZ_TIME -timeout=10 \
+     -max_len=1024 "$@" $OUT/filter-corpus)
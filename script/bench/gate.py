@@ -0,0 +1,177 @@
+#!/usr/bin/env python3
+"""Performance regression gate of script/bench/gate.sh.
+
+  gate.py record [--deterministic] <results directory> > baseline.json
+  gate.py compare [--deterministic] <baseline.json> <results directory>
+
+Results directory holds "<benchmark>-<run>.jsonl" files, one per repeated
+run. Every JSON line is identified by benchmark and its non-metric fields;
+samples of every metric are gathered across runs. "compare" fails if median
+of a metric is worse than baseline by more than its tolerance and, unless
+samples are constant, Mann-Whitney U test finds the difference significant.
+TOLERANCE environment variable (percent) overrides all tolerances.
+
+"--deterministic" keeps only metrics that do not depend on the machine
+(DETERMINISTIC), so such baseline can be committed and compared anywhere.
+"compare" checks metrics of the baseline only: timing metrics missing from it
+are skipped.
+"""
+
+import json
+import os
+import statistics
+import sys
+
+ALPHA = 0.05
+
+# Metric: (1 if higher is better, -1 if lower is better, tolerance percent).
+METRICS = {
+    "ratio": (1, 0.5),
+    "bytes_out": (-1, 0.5),
+    "mb_s": (1, 10),
+    "cpu_mb_s": (1, 10),
+    "peak_memory": (-1, 5),
+    "ns_per_byte": (-1, 10),
+    "calls": (-1, 0),
+    "next_calls": (-1, 0),
+    "again": (-1, 0),
+    "encoder_allocs": (-1, 0),
+    "pool_bytes": (-1, 5),
+    "rps": (1, 10),
+    "p50_ms": (-1, 20),
+    "p99_ms": (-1, 25),
+    "cpu_us_per_request": (-1, 10),
+}
+
+# Metrics that are the same on every machine for the same code and input.
+DETERMINISTIC = {"ratio", "bytes_out", "calls", "next_calls", "again",
+                 "encoder_allocs"}
+
+# Fields that are neither metrics nor identity.
+IGNORED = {"runs", "requests", "errors", "rss_kb", "size", "bytes_in",
+           "effective_window", "hz", "cpu_ticks"}
+
+
+def load(directory, metrics=METRICS):
+  samples = {}
+  for name in sorted(os.listdir(directory)):
+    if not name.endswith(".jsonl"):
+      continue
+    benchmark = name.rsplit("-", 1)[0]
+    for line in open(os.path.join(directory, name)):
+      if not line.strip():
+        continue
+      result = json.loads(line)
+      key = " ".join([benchmark] + [
+          "%s=%s" % (k, result[k]) for k in sorted(result)
+          if k not in METRICS and k not in IGNORED])
+      for metric in metrics:
+        if result.get(metric) is not None:
+          samples.setdefault(key, {}).setdefault(metric, []).append(
+              result[metric])
+  return samples
+
+
+def u_distribution(n1, n2):
+  """Number of arrangements of n1 + n2 samples giving each value of U."""
+  # counts[i][j][u]: arrangements of i and j samples with U == u.
+  counts = [[None] * (n2 + 1) for _ in range(n1 + 1)]
+  for i in range(n1 + 1):
+    for j in range(n2 + 1):
+      if i == 0 or j == 0:
+        counts[i][j] = [1]
+        continue
+      size = i * j + 1
+      c = [0] * size
+      # Largest sample is from first group: it beats all j of second group.
+      for u, n in enumerate(counts[i - 1][j]):
+        c[u + j] += n
+      for u, n in enumerate(counts[i][j - 1]):
+        c[u] += n
+      counts[i][j] = c
+  return counts[n1][n2]
+
+
+def p_worse(before, after, direction):
+  """One-sided p-value of "after" being worse than "before"."""
+  # U counts pairs where "after" sample is worse; ties count half.
+  u = 0.0
+  for a in after:
+    for b in before:
+      if (a - b) * direction < 0:
+        u += 1
+      elif a == b:
+        u += 0.5
+  dist = u_distribution(len(after), len(before))
+  total = float(sum(dist))
+  return sum(n for value, n in enumerate(dist) if value >= u) / total
+
+
+def compare(baseline, samples):
+  override = os.environ.get("TOLERANCE")
+  failures = 0
+  skipped = set()
+
+  for key in samples:
+    if key in baseline:
+      skipped.update(set(samples[key]) - set(baseline[key]))
+
+  for key in sorted(baseline):
+    for metric, before in sorted(baseline[key].items()):
+      after = samples.get(key, {}).get(metric)
+      if not after:
+        print("MISSING     %s %s" % (key, metric))
+        failures += 1
+        continue
+
+      direction, tolerance = METRICS[metric]
+      if override is not None:
+        tolerance = float(override)
+
+      old = statistics.median(before)
+      new = statistics.median(after)
+      change = (new - old) * 100.0 / old if old else 0.0
+      worse = -change * direction > tolerance
+      constant = len(set(before)) == 1 and len(set(after)) == 1
+      p = 0.0 if constant else p_worse(before, after, direction)
+
+      if worse and p < ALPHA:
+        status = "REGRESSION"
+        failures += 1
+      elif change * direction > tolerance and p < ALPHA:
+        status = "improved"
+      else:
+        continue
+
+      print("%-11s %s %s: %g -> %g (%+.1f%%, p=%.3f)" %
+            (status, key, metric, old, new, change, p))
+
+  if skipped:
+    print("Not in baseline, skipped: %s" % ", ".join(sorted(skipped)))
+
+  return failures
+
+
+def main():
+  args = sys.argv[1:]
+  metrics = METRICS
+  if len(args) > 1 and args[1] == "--deterministic":
+    metrics = DETERMINISTIC
+    del args[1]
+
+  if len(args) == 2 and args[0] == "record":
+    print(json.dumps(load(args[1], metrics), indent=2, sort_keys=True))
+  elif len(args) == 3 and args[0] == "compare":
+    baseline = {}
+    for key, values in json.load(open(args[1])).items():
+      baseline[key] = {m: v for m, v in values.items() if m in metrics}
+    failures = compare(baseline, load(args[2]))
+    if failures:
+      sys.exit("%d regressions" % failures)
+    print("No regressions")
+  else:
+    sys.exit(__doc__)
+
+
+if __name__ == "__main__":
+  main()
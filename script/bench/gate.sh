@@ -0,0 +1,122 @@
+#!/bin/bash
+set -e
+
+# Performance regression gate: runs a fixed set of corpus, body filter and
+# load benchmarks RUNS times, and compares results with
+# script/bench/baseline.json (see gate.py for tolerances).
+#
+#   script/bench/gate.sh record     - writes new baseline
+#   script/bench/gate.sh [compare]  - fails on regression
+#   script/bench/gate.sh ci         - compares machine independent metrics
+#
+# With GATE_BASE set to a git revision, nothing is run unless filter/ or
+# static/ differ from it, e.g. GATE_BASE=origin/master script/bench/gate.sh
+#
+# With DETERMINISTIC=1, and always in "ci", corpus and body filter benchmarks
+# run once and only metrics that do not depend on the machine are kept:
+# ratio, output size, filter calls and encoder allocations. Such baseline,
+# written by "DETERMINISTIC=1 script/bench/gate.sh record", can be committed.
+# Without committed baseline, "ci" records it on the spot from GATE_BASE,
+# checked out with "git worktree" and built against the same nginx.
+
+. script/bench/common.sh
+
+MODE=${1:-compare}
+RUNS=${RUNS:-5}
+BASELINE=${BASELINE:-$BENCH/baseline.json}
+GATE=$OUT/gate
+
+if [ -n "$GATE_BASE" ] && git diff --quiet $GATE_BASE -- filter static; then
+  echo "filter/ and static/ are unchanged since $GATE_BASE"
+  exit 0
+fi
+
+case $MODE in
+  record | compare | ci) ;;
+  *)
+    echo "usage: $0 [record | compare | ci]" >&2
+    exit 2
+    ;;
+esac
+
+if [ $MODE = compare ] && [ ! -f $BASELINE ]; then
+  echo "$BASELINE is not found; run \"$0 record\" on unchanged tree" >&2
+  exit 1
+fi
+
+if [ $MODE = ci ]; then
+  DETERMINISTIC=1
+  if [ ! -f $BASELINE ] && [ -z "$GATE_BASE" ]; then
+    echo "$BASELINE is not found; set GATE_BASE to record it" >&2
+    exit 1
+  fi
+fi
+
+if [ -n "$DETERMINISTIC" ]; then
+  RUNS=1
+fi
+
+# Builds benchmarks of <bench directory> into <out directory>, and runs them
+# RUNS times into <results directory>. DETERMINISTIC skips load benchmarks.
+gate_run() {
+  local out=$2
+  local results=$3
+
+  (
+    BENCH=$1
+    OUT=$out
+    mkdir -p $OUT
+    bench_build corpus_bench
+    bench_build filter_bench -Wl,--wrap=BrotliEncoderCreateInstance \
+        -lbrotlidec
+  )
+
+  rm -rf $results
+  mkdir -p $results
+
+  for run in `seq $RUNS`; do
+    echo "run $run of $RUNS"
+    (cd $OUT/corpus && $out/corpus_bench 1-1 22-22 html-128k.html \
+         json-128k.json js-1m.js > $results/corpus-$run.jsonl &&
+     $out/corpus_bench 6-6 22-22 html-128k.html json-128k.json js-1m.js \
+         >> $results/corpus-$run.jsonl &&
+     $out/filter_bench 6 html-128k.html ndjson-1m.ndjson \
+         > $results/filter-$run.jsonl)
+    if [ -z "$DETERMINISTIC" ]; then
+      QUALITIES=6 FILES=html-128k.html CONCURRENCY=16 PROTOCOLS=http1 \
+          DURATION=${LOAD_DURATION:-3} RESULTS=$results/load-$run.jsonl \
+          script/bench/load.sh > /dev/null
+    fi
+  done
+}
+
+python3 $BENCH/corpus.py $OUT/corpus
+
+if [ $MODE = ci ] && [ ! -f $BASELINE ]; then
+  BASE_TREE=$OUT/gate-base-tree
+  BASELINE=$OUT/gate-base.json
+
+  rm -rf $BASE_TREE
+  git worktree prune
+  git worktree add --detach $BASE_TREE $GATE_BASE
+  trap "git worktree remove --force $BASE_TREE" EXIT
+
+  echo "recording baseline of $GATE_BASE"
+  gate_run $BASE_TREE/script/bench $OUT/gate-base $OUT/gate-base-results
+  python3 $BENCH/gate.py record --deterministic $OUT/gate-base-results \
+      > $BASELINE
+fi
+
+gate_run $BENCH $OUT $GATE
+
+case $MODE in
+  record)
+    python3 $BENCH/gate.py record ${DETERMINISTIC:+--deterministic} $GATE \
+        > $BASELINE
+    echo "Baseline written to $BASELINE"
+    ;;
+  compare | ci)
+    python3 $BENCH/gate.py compare ${DETERMINISTIC:+--deterministic} \
+        $BASELINE $GATE
+    ;;
+esac
@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+"""Turns h2load report and nginx log of script/bench/h2mux.sh into JSON line:
+connection throughput, completion time of streams by file, and fairness of
+streams that share a connection.
+
+  h2mux.py <h2load report> <nginx log> [key=value...]
+
+Fairness is Jain's index of stream throughput (bytes sent per second) among
+streams of the same file in the same connection: 1 if all got the same, 1/n
+if one got everything. "fairness" is its mean over connections and files,
+"fairness_min" the worst one. Keys given on command line are copied to
+output.
+"""
+
+import collections
+import json
+import re
+import sys
+
+UNITS = {"B": 1e-6, "KB": 1e-3, "MB": 1.0, "GB": 1e3}
+
+
+def percentile(values, p):
+  values = sorted(values)
+  if not values:
+    return None
+  return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def jain(values):
+  total = sum(values)
+  squares = sum(v * v for v in values)
+  return total * total / (len(values) * squares) if squares else 1.0
+
+
+def main():
+  if len(sys.argv) < 3:
+    sys.exit(__doc__)
+
+  result = {}
+  for arg in sys.argv[3:]:
+    key, value = arg.split("=", 1)
+    result[key] = int(value) if value.isdigit() else value
+
+  text = open(sys.argv[1]).read()
+  finished = re.search(r"finished in \S+, ([\d.]+) req/s, ([\d.]+)(\w+)/s",
+                       text)
+  done = re.search(r"requests: \d+ total, \d+ started, (\d+) done, "
+                   r"(\d+) succeeded", text)
+  result.update({
+      "requests": int(done.group(2)),
+      "errors": int(done.group(1)) - int(done.group(2)),
+      "rps": float(finished.group(1)),
+      "mb_s": round(float(finished.group(2)) * UNITS[finished.group(3)], 3),
+  })
+
+  streams = [json.loads(line) for line in open(sys.argv[2]) if line.strip()]
+
+  times = collections.defaultdict(list)
+  shares = collections.defaultdict(list)
+  for s in streams:
+    times[s["uri"]].append(s["request_time"] * 1000)
+    if s["request_time"] > 0:
+      shares[(s["connection"], s["uri"])].append(
+          s["bytes_sent"] / s["request_time"])
+
+  result["files"] = {
+      uri.lstrip("/"): {
+          "streams": len(t),
+          "p50_ms": percentile(t, 50),
+          "p99_ms": percentile(t, 99),
+          "max_ms": max(t),
+      } for uri, t in sorted(times.items())}
+
+  indexes = [jain(v) for v in shares.values() if len(v) > 1]
+  result["fairness"] = (round(sum(indexes) / len(indexes), 3)
+                        if indexes else None)
+  result["fairness_min"] = round(min(indexes), 3) if indexes else None
+
+  print(json.dumps(result))
+
+
+if __name__ == "__main__":
+  main()
@@ -0,0 +1,45 @@
+#!/bin/bash
+set -e
+
+# HTTP/2 multiplexing benchmark: h2load opens CONNECTIONS connections with
+# STREAMS concurrent streams each, for a mix of corpus files, all compressed.
+# For every quality it writes connection throughput, completion times of
+# streams by file, from nginx log, and fairness of streams that share a
+# connection to script/bench/out/h2mux.jsonl, one JSON object per line.
+#
+#   QUALITIES="1 6" CONNECTIONS=4 REQUESTS=20000 script/bench/h2mux.sh
+
+. script/bench/common.sh
+
+QUALITIES=${QUALITIES:-"1 6 11"}
+FILES=${FILES:-"html-1k.html html-16k.html html-128k.html html-1m.html
+                json-16k.json js-128k.js css-1m.css"}
+CONNECTIONS=${CONNECTIONS:-4}
+STREAMS=${STREAMS:-100}
+REQUESTS=${REQUESTS:-10000}
+RESULTS=${RESULTS:-$OUT/h2mux.jsonl}
+
+python3 $BENCH/corpus.py $OUT/corpus
+
+for file in $FILES; do
+  echo "http://127.0.0.1:8086/$file"
+done > $OUT/h2mux-uris.txt
+
+: > $RESULTS
+
+for quality in $QUALITIES; do
+  echo "quality $quality, $CONNECTIONS connections of $STREAMS streams"
+
+  rm -f $OUT/h2mux.log
+  nginx_start $quality
+
+  h2load -c $CONNECTIONS -m $STREAMS -n $REQUESTS \
+      -H 'Accept-Encoding: br' -i $OUT/h2mux-uris.txt > $OUT/report.txt
+
+  nginx_stop
+
+  python3 $BENCH/h2mux.py $OUT/report.txt $OUT/h2mux.log quality=$quality \
+      connections=$CONNECTIONS streams=$STREAMS >> $RESULTS
+done
+
+echo "Results: `wc -l < $RESULTS` runs in $RESULTS"
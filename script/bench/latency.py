@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+"""Client of script/bench/latency.sh: reads one streaming response through
+nginx and writes JSON line with time to first byte and delay of every event
+between backend writing it and client decoding it.
+
+  latency.py <port> <path> [key=value...]
+
+Keys given on command line are copied to output. Needs "brotli" Python
+module for compressed responses.
+"""
+
+import json
+import re
+import socket
+import sys
+import time
+
+# End of event line, with time it was written.
+EVENT = re.compile(rb"(?:\"t\":|data-t=\")(\d+)[^\n]*\n")
+
+
+def percentile(values, p):
+  values = sorted(values)
+  if not values:
+    return None
+  return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def ms(ns):
+  return None if ns is None else round(ns / 1e6, 3)
+
+
+def main():
+  port, path = int(sys.argv[1]), sys.argv[2]
+  result = {}
+  for arg in sys.argv[3:]:
+    key, value = arg.split("=", 1)
+    result[key] = int(value) if value.isdigit() else value
+
+  start = time.monotonic_ns()
+  sock = socket.create_connection(("127.0.0.1", port))
+  sock.sendall(("GET %s HTTP/1.0\r\nHost: localhost\r\n"
+                "Accept-Encoding: br\r\n\r\n" % path).encode())
+
+  head = b""
+  decoder = None
+  first_byte = None
+  text = b""
+  delays = []
+  gaps = []
+  last_read = None
+  reads = 0
+  wire = 0
+
+  while True:
+    data = sock.recv(65536)
+    now = time.monotonic_ns()
+    if not data:
+      break
+
+    if decoder is None:
+      head += data
+      if b"\r\n\r\n" not in head:
+        continue
+      head, data = head.split(b"\r\n\r\n", 1)
+      if re.search(rb"(?im)^content-encoding:\s*br\s*$", head):
+        import brotli
+        decoder = brotli.Decompressor()
+      else:
+        decoder = False
+      if not data:
+        continue
+
+    if first_byte is None:
+      first_byte = now - start
+    if last_read is not None:
+      gaps.append(now - last_read)
+    last_read = now
+    reads += 1
+    wire += len(data)
+
+    text += decoder.process(data) if decoder else data
+    end = 0
+    for match in EVENT.finditer(text):
+      delays.append(now - int(match.group(1)))
+      end = match.end()
+    text = text[end:]
+
+  sock.close()
+
+  result.update({
+      "compressed": bool(decoder),
+      "events": len(delays),
+      "reads": reads,
+      "bytes": wire,
+      "ttfb_ms": ms(first_byte),
+      "first_event_ms": ms(delays[0]) if delays else None,
+      "delay_p50_ms": ms(percentile(delays, 50)),
+      "delay_p99_ms": ms(percentile(delays, 99)),
+      "delay_max_ms": ms(max(delays)) if delays else None,
+      "gap_p99_ms": ms(percentile(gaps, 99)),
+  })
+  print(json.dumps(result))
+
+
+if __name__ == "__main__":
+  main()
@@ -0,0 +1,47 @@
+#!/bin/bash
+set -e
+
+# Streaming latency: nginx proxies paced output of script/bench/backend.py
+# (SSE, NDJSON and slowly generated HTML) with proxy buffering on and off,
+# and uncompressed for reference. For every quality it records time to first
+# byte and delay between backend writing an event and client decoding it.
+# Results are written to script/bench/out/latency.jsonl, one JSON object per
+# line. Needs "brotli" Python module.
+#
+#   QUALITIES="1 6" KINDS=sse EVENTS=50 INTERVAL=20 script/bench/latency.sh
+
+. script/bench/common.sh
+
+QUALITIES=${QUALITIES:-"1 4 6 9 11"}
+KINDS=${KINDS:-"sse ndjson html"}
+MODES=${MODES:-"unbuffered buffered identity"}
+EVENTS=${EVENTS:-100}
+INTERVAL=${INTERVAL:-50}
+SIZE=${SIZE:-200}
+RESULTS=${RESULTS:-$OUT/latency.jsonl}
+
+python3 -c "import brotli"
+
+: > $RESULTS
+
+python3 $BENCH/backend.py 8090 &
+BACKEND=$!
+trap "kill $BACKEND" EXIT
+
+for quality in $QUALITIES; do
+  nginx_start $quality
+
+  for mode in $MODES; do
+    for kind in $KINDS; do
+      echo "quality $quality, $mode, $kind"
+      python3 $BENCH/latency.py 8084 \
+          "/$mode/$kind?events=$EVENTS&interval=$INTERVAL&size=$SIZE" \
+          quality=$quality mode=$mode kind=$kind interval_ms=$INTERVAL \
+          size=$SIZE >> $RESULTS
+    done
+  done
+
+  nginx_stop
+done
+
+echo "Results: `wc -l < $RESULTS` runs in $RESULTS"
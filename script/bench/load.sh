@@ -0,0 +1,85 @@
+#!/bin/bash
+set -e
+
+# End-to-end load test: nginx with the module on loopback, driven by wrk
+# (HTTP/1.1) and h2load (HTTP/2) across response sizes, qualities and
+# concurrency. Results are written to script/bench/out/load.jsonl: requests/s,
+# p50 and p99 latency, worker CPU time per request and worker RSS.
+#
+# Matrix and run length are set by environment, e.g.
+#   QUALITIES="1 6" FILES="html-16k.html" CONCURRENCY="16" DURATION=3 \
+#       script/bench/load.sh
+
+. script/bench/common.sh
+
+QUALITIES=${QUALITIES:-"1 4 6 9 11"}
+FILES=${FILES:-"html-1k.html html-16k.html html-128k.html html-1m.html"}
+CONCURRENCY=${CONCURRENCY:-"1 16 64 256"}
+PROTOCOLS=${PROTOCOLS:-"http1 http2"}
+WORKERS=${WORKERS:-1}
+DURATION=${DURATION:-10}
+RESULTS=${RESULTS:-$OUT/load.jsonl}
+
+HZ=`getconf CLK_TCK`
+THREADS=`nproc`
+
+python3 $BENCH/corpus.py $OUT/corpus
+: > $RESULTS
+
+# Runs one load generator; prints its report file.
+run() {
+  protocol=$1
+  file=$2
+  clients=$3
+  report=$OUT/report.txt
+
+  case $protocol in
+    http1)
+      wrk -t $((clients < THREADS ? clients : THREADS)) -c $clients \
+          -d ${DURATION}s --latency -H 'Accept-Encoding: br' \
+          http://127.0.0.1:8081/$file > $report
+      ;;
+    http2)
+      rm -f $OUT/h2load.log
+      h2load -t $((clients < THREADS ? clients : THREADS)) -c $clients \
+          -D $DURATION -H 'Accept-Encoding: br' --log-file=$OUT/h2load.log \
+          http://127.0.0.1:8082/$file > $report
+      ;;
+  esac
+}
+
+for protocol in $PROTOCOLS; do
+  tool=wrk
+  if [ $protocol = http2 ]; then
+    tool=h2load
+  fi
+  if ! command -v $tool > /dev/null; then
+    echo "$tool is not found, skipping $protocol"
+    PROTOCOLS=`echo $PROTOCOLS | sed "s/$protocol//"`
+  fi
+done
+
+for quality in $QUALITIES; do
+  nginx_start $quality
+
+  for protocol in $PROTOCOLS; do
+    for file in $FILES; do
+      for clients in $CONCURRENCY; do
+        echo "quality $quality, $protocol, $file, $clients clients"
+
+        ticks=`cpu_ticks`
+        run $protocol $file $clients
+        ticks=$((`cpu_ticks` - ticks))
+
+        python3 $BENCH/loadstat.py $protocol $OUT/report.txt \
+            $OUT/h2load.log protocol=$protocol file=$file \
+            quality=$quality workers=$WORKERS clients=$clients \
+            cpu_ticks=$ticks hz=$HZ rss_kb=`rss_kb` >> $RESULTS
+      done
+    done
+  done
+
+  nginx_stop
+done
+
+echo "Results: `wc -l < $RESULTS` runs in $RESULTS"
@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+"""Turns load generator report into JSON line of script/bench/load.sh.
+
+  loadstat.py http1 <wrk report> <unused> [key=value...]
+  loadstat.py http2 <h2load report> <h2load log> [key=value...]
+
+Keys given on command line are copied to output; "cpu_ticks" and "hz" are
+turned into worker CPU time per request.
+"""
+
+import json
+import re
+import sys
+
+UNITS = {"us": 0.001, "ms": 1.0, "s": 1000.0, "m": 60000.0}
+
+
+def ms(value):
+  number, unit = re.match(r"([\d.]+)(us|ms|s|m)$", value).groups()
+  return float(number) * UNITS[unit]
+
+
+def percentile(values, p):
+  values = sorted(values)
+  if not values:
+    return None
+  return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def wrk(report, _):
+  text = open(report).read()
+  result = {
+      "requests": int(re.search(r"(\d+) requests in", text).group(1)),
+      "rps": float(re.search(r"Requests/sec:\s+([\d.]+)", text).group(1)),
+  }
+  for p in (50, 99):
+    result["p%d_ms" % p] = ms(
+        re.search(r"^\s+%d%%\s+(\S+)" % p, text, re.M).group(1))
+  errors = re.search(r"Non-2xx or 3xx responses: (\d+)", text)
+  result["errors"] = int(errors.group(1)) if errors else 0
+  return result
+
+
+def h2load(report, log):
+  text = open(report).read()
+  done = re.search(r"requests: \d+ total, \d+ started, (\d+) done, "
+                   r"(\d+) succeeded", text)
+  result = {
+      "requests": int(done.group(2)),
+      "rps": float(re.search(r"finished in \S+, ([\d.]+) req/s", text)
+                   .group(1)),
+      "errors": int(done.group(1)) - int(done.group(2)),
+  }
+  # Log lines: start time, status, duration in microseconds.
+  durations = [int(line.split()[2]) / 1000.0 for line in open(log)
+               if line.strip()]
+  for p in (50, 99):
+    result["p%d_ms" % p] = percentile(durations, p)
+  return result
+
+
+def number(value):
+  for convert in (int, float):
+    try:
+      return convert(value)
+    except ValueError:
+      pass
+  return value
+
+
+def main():
+  if len(sys.argv) < 4:
+    sys.exit(__doc__)
+
+  parse = {"http1": wrk, "http2": h2load}[sys.argv[1]]
+
+  extra = dict(arg.split("=", 1) for arg in sys.argv[4:])
+  extra = {key: number(value) for key, value in extra.items()}
+
+  result = dict(extra)
+  result.update(parse(sys.argv[2], sys.argv[3]))
+
+  ticks = result.pop("cpu_ticks", None)
+  hz = result.pop("hz", None)
+  if ticks is not None and hz and result["requests"]:
+    result["cpu_us_per_request"] = round(
+        ticks * 1e6 / hz / result["requests"], 1)
+
+  print(json.dumps(result, sort_keys=True))
+
+
+if __name__ == "__main__":
+  main()
@@ -0,0 +1,430 @@
+/*
+ * Copyright (C) Google Inc.
+ */
+
+/*
+ * Benchmark harness. The filter module is compiled into every benchmark, so
+ * that benchmarks drive its static functions with the same configuration and
+ * context a request would have; see script/bench/common.sh.
+ */
+
+#ifndef NGX_HTTP_BROTLI_BENCH_H_
+#define NGX_HTTP_BROTLI_BENCH_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../../filter/ngx_http_brotli_filter_module.c"
+
+typedef struct {
+  ngx_log_t log;
+  ngx_open_file_t log_file;
+  ngx_pool_t* pool;
+
+  /* Module configuration; fields are set as if merged with defaults, and may
+     be changed between requests. */
+  ngx_http_brotli_main_conf_t* mcf;
+  ngx_http_brotli_conf_t* conf;
+
+  void* main_conf[1];
+  void* loc_conf[1];
+} ngx_http_brotli_bench_t;
+
+static ngx_inline ngx_int_t ngx_http_brotli_bench_init(
+    ngx_http_brotli_bench_t* b) {
+  ngx_conf_t cf;
+
+  ngx_memzero(b, sizeof(ngx_http_brotli_bench_t));
+
+  ngx_pagesize = getpagesize();
+  ngx_cacheline_size = NGX_CPU_CACHE_LINE;
+  ngx_time_init();
+
+  b->log_file.fd = ngx_stderr;
+  b->log.file = &b->log_file;
+  b->log.log_level = NGX_LOG_WARN;
+
+  b->pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, &b->log);
+  if (b->pool == NULL) {
+    return NGX_ERROR;
+  }
+
+  ngx_memzero(&cf, sizeof(ngx_conf_t));
+  cf.pool = b->pool;
+  cf.temp_pool = b->pool;
+  cf.log = &b->log;
+
+  b->mcf = ngx_http_brotli_create_main_conf(&cf);
+  b->conf = ngx_http_brotli_create_conf(&cf);
+  if (b->mcf == NULL || b->conf == NULL) {
+    return NGX_ERROR;
+  }
+
+  /* See ngx_http_brotli_merge_conf(). */
+  b->conf->enable = 1;
+  b->conf->quality = 6;
+  b->conf->lg_win = BROTLI_DEFAULT_WINDOW;
+  b->conf->size_levels = NULL;
+  b->conf->size_unknown_level = -1;
+  b->conf->min_length = 20;
+  b->conf->lookahead = 0;
+  b->conf->block_warn = 0;
+  b->conf->stats_server = NGX_HTTP_BROTLI_STATS_NONE;
+  b->conf->stats_location = NGX_HTTP_BROTLI_STATS_NONE;
+  b->conf->tenant_quota = 0;
+  /* See ngx_http_brotli_filter_init(); benchmarks report encoder time. */
+  b->mcf->timing = 1;
+
+  /* Configuration is not parsed, so module is the only one indexed. */
+  ngx_http_brotli_filter_module.ctx_index = 0;
+  b->main_conf[0] = b->mcf;
+  b->loc_conf[0] = b->conf;
+
+  return NGX_OK;
+}
+
+/* Creates request with own pool, and context that header filter would
+   create for compressed response; finish it with
+   ngx_http_brotli_bench_free_request(). */
+static ngx_inline ngx_http_request_t* ngx_http_brotli_bench_request(
+    ngx_http_brotli_bench_t* b, off_t content_length) {
+  ngx_http_brotli_ctx_t* ctx;
+  ngx_http_request_t* r;
+  ngx_connection_t* c;
+  ngx_pool_t* pool;
+
+  pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, &b->log);
+  if (pool == NULL) {
+    return NULL;
+  }
+
+  c = ngx_pcalloc(pool, sizeof(ngx_connection_t));
+  r = ngx_pcalloc(pool, sizeof(ngx_http_request_t));
+  ctx = ngx_pcalloc(pool, sizeof(ngx_http_brotli_ctx_t));
+  if (c == NULL || r == NULL || ctx == NULL) {
+    ngx_destroy_pool(pool);
+    return NULL;
+  }
+
+  c->log = &b->log;
+  c->pool = pool;
+  c->fd = (ngx_socket_t)-1;
+
+  r->connection = c;
+  r->pool = pool;
+  r->main = r;
+  r->main_conf = b->main_conf;
+  r->loc_conf = b->loc_conf;
+  r->ctx = ngx_pcalloc(pool, sizeof(void*));
+  if (r->ctx == NULL) {
+    ngx_destroy_pool(pool);
+    return NULL;
+  }
+  r->headers_out.content_length_n = content_length;
+
+  ctx->request = r;
+  ctx->pool = pool;
+  ctx->content_length = content_length;
+  ctx->start_usec = ngx_http_brotli_monotonic_usec();
+  ngx_http_set_ctx(r, ctx, ngx_http_brotli_filter_module);
+
+  return r;
+}
+
+/* Destroys request pool as ngx_http_free_request() does: cleanups run with
+   r->pool already cleared. */
+static ngx_inline void ngx_http_brotli_bench_free_request(
+    ngx_http_request_t* r) {
+  ngx_pool_t* pool;
+
+  pool = r->pool;
+  r->pool = NULL;
+  ngx_destroy_pool(pool);
+}
+
+static ngx_inline uint64_t ngx_http_brotli_bench_nsec(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Reads whole file into harness pool. */
+static ngx_inline ngx_int_t ngx_http_brotli_bench_read(
+    ngx_http_brotli_bench_t* b, const char* path, ngx_str_t* data) {
+  FILE* f;
+  long size;
+
+  f = fopen(path, "rb");
+  if (f == NULL) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return NGX_ERROR;
+  }
+
+  if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 ||
+      fseek(f, 0, SEEK_SET) != 0) {
+    fclose(f);
+    return NGX_ERROR;
+  }
+
+  data->len = (size_t)size;
+  data->data = ngx_palloc(b->pool, data->len + 1);
+  if (data->data == NULL ||
+      fread(data->data, 1, data->len, f) != data->len) {
+    fclose(f);
+    return NGX_ERROR;
+  }
+
+  fclose(f);
+
+  return NGX_OK;
+}
+
+/* Parses "min-max" or single value. */
+static ngx_inline ngx_int_t ngx_http_brotli_bench_range(const char* s,
+                                                        ngx_uint_t* min,
+                                                        ngx_uint_t* max) {
+  char* end;
+
+  *min = strtoul(s, &end, 10);
+  *max = *min;
+
+  if (*end == '-') {
+    *max = strtoul(end + 1, &end, 10);
+  }
+
+  return (*end == '\0' && *min <= *max) ? NGX_OK : NGX_ERROR;
+}
+
+/* Bytes used in small blocks of pool, and live large allocations. */
+static ngx_inline void ngx_http_brotli_bench_pool_usage(ngx_pool_t* pool,
+                                                       size_t* bytes,
+                                                       ngx_uint_t* large) {
+  ngx_pool_large_t* l;
+  ngx_pool_t* p;
+
+  *bytes = 0;
+  *large = 0;
+
+  for (p = pool; p; p = p->d.next) {
+    *bytes += p->d.last - (u_char*)p;
+  }
+
+  for (l = pool->large; l; l = l->next) {
+    if (l->alloc) {
+      (*large)++;
+    }
+  }
+}
+
+/* Pending buffers of mock client; the filter passes one at a time. */
+#define NGX_HTTP_BROTLI_BENCH_PENDING 16
+
+/* Mock of the rest of filter chain: client that takes at most "rate" bytes
+   per call, as a socket would; NGX_AGAIN is returned while anything is left,
+   or NGX_OK, if "lazy" is set, as write filter does below postpone_output.
+   "blocked" calls take nothing, as if socket buffer was full. Output is kept,
+   if "keep" is set. */
+typedef struct {
+  size_t rate;
+  ngx_uint_t blocked;
+  unsigned keep : 1;
+  unsigned lazy : 1;
+
+  ngx_buf_t* pending[NGX_HTTP_BROTLI_BENCH_PENDING];
+  ngx_uint_t npending;
+
+  u_char* data;
+  size_t len;
+  size_t size;
+
+  size_t bytes;
+  ngx_uint_t calls;
+  ngx_uint_t again;
+  ngx_uint_t last_buf;
+} ngx_http_brotli_bench_client_t;
+
+static ngx_http_brotli_bench_client_t* ngx_http_brotli_bench_client;
+
+static ngx_inline ngx_int_t ngx_http_brotli_bench_next(ngx_http_request_t* r,
+                                                       ngx_chain_t* in) {
+  ngx_http_brotli_bench_client_t* c = ngx_http_brotli_bench_client;
+  ngx_buf_t* buf;
+  size_t budget;
+  size_t n;
+  u_char* p;
+
+  c->calls++;
+
+  for (/* void */; in; in = in->next) {
+    if (c->npending == NGX_HTTP_BROTLI_BENCH_PENDING) {
+      return NGX_ERROR;
+    }
+    c->pending[c->npending++] = in->buf;
+    if (in->buf->last_buf) {
+      c->last_buf++;
+    }
+  }
+
+  budget = c->rate ? c->rate : (size_t)-1;
+  if (c->blocked) {
+    c->blocked--;
+    budget = 0;
+  }
+
+  while (c->npending) {
+    buf = c->pending[0];
+    n = ngx_min((size_t)ngx_buf_size(buf), budget);
+
+    if (c->keep && n) {
+      if (c->len + n > c->size) {
+        c->size = ngx_max(c->size * 2, c->len + n);
+        p = realloc(c->data, c->size);
+        if (p == NULL) {
+          return NGX_ERROR;
+        }
+        c->data = p;
+      }
+      ngx_memcpy(c->data + c->len, buf->pos, n);
+      c->len += n;
+    }
+
+    buf->pos += n;
+    c->bytes += n;
+    budget -= n;
+
+    if (ngx_buf_size(buf)) {
+      break;
+    }
+
+    c->npending--;
+    ngx_memmove(c->pending, c->pending + 1,
+                c->npending * sizeof(ngx_buf_t*));
+  }
+
+  if (c->npending) {
+    if (c->lazy) {
+      return NGX_OK;
+    }
+    c->again++;
+    return NGX_AGAIN;
+  }
+
+  return NGX_OK;
+}
+
+/* How upstream passes response body to the filter. */
+typedef struct {
+  /* Buffer size; 0 - whole body in one buffer. */
+  size_t buf_size;
+  /* Buffers per body filter call. */
+  ngx_uint_t bufs;
+  /* Buffer that crosses a multiple of this offset is flushed; 0 - never. */
+  size_t flush;
+} ngx_http_brotli_bench_shape_t;
+
+/* Returns next chain of data from *pos; the last buffer, which is empty for
+   empty data, has last_buf set, and *pos is past data then. */
+static ngx_inline ngx_chain_t* ngx_http_brotli_bench_chain(
+    ngx_pool_t* pool, ngx_str_t* data, size_t* pos,
+    ngx_http_brotli_bench_shape_t* shape) {
+  ngx_chain_t* out;
+  ngx_chain_t** ll;
+  ngx_chain_t* cl;
+  ngx_buf_t* buf;
+  ngx_uint_t i;
+  size_t size;
+
+  out = NULL;
+  ll = &out;
+
+  for (i = 0; i < shape->bufs && *pos <= data->len; i++) {
+    size = data->len - *pos;
+    if (shape->buf_size && size > shape->buf_size) {
+      size = shape->buf_size;
+    }
+
+    buf = ngx_calloc_buf(pool);
+    cl = ngx_alloc_chain_link(pool);
+    if (buf == NULL || cl == NULL) {
+      return NULL;
+    }
+
+    buf->pos = data->data + *pos;
+    buf->last = buf->pos + size;
+    buf->start = buf->pos;
+    buf->end = buf->last;
+    buf->memory = 1;
+
+    if (shape->flush && size &&
+        *pos / shape->flush != (*pos + size) / shape->flush) {
+      buf->flush = 1;
+    }
+
+    *pos += size;
+    if (*pos == data->len) {
+      buf->last_buf = 1;
+      (*pos)++;
+    }
+
+    cl->buf = buf;
+    cl->next = NULL;
+    *ll = cl;
+    ll = &cl->next;
+  }
+
+  return out;
+}
+
+/* Streams data through the body filter, as upstream and client of given
+   shape and rate would, until response is complete. Returns NGX_ERROR on
+   filter error, or if a call without new input makes no progress. */
+static ngx_inline ngx_int_t ngx_http_brotli_bench_stream(
+    ngx_http_request_t* r, ngx_pool_t* upstream, ngx_str_t* data,
+    ngx_http_brotli_bench_shape_t* shape, ngx_http_brotli_bench_client_t* c,
+    ngx_uint_t* calls) {
+  ngx_http_brotli_ctx_t* ctx;
+  ngx_chain_t* in;
+  ngx_int_t rc;
+  size_t bytes;
+  size_t pos;
+
+  ngx_http_next_body_filter = ngx_http_brotli_bench_next;
+  ngx_http_brotli_bench_client = c;
+
+  ctx = ngx_http_get_module_ctx(r, ngx_http_brotli_filter_module);
+  pos = 0;
+
+  for (;;) {
+    in = NULL;
+    if (pos <= data->len) {
+      in = ngx_http_brotli_bench_chain(upstream, data, &pos, shape);
+      if (in == NULL) {
+        return NGX_ERROR;
+      }
+
+    } else if (ctx->closed && c->npending == 0) {
+      return ctx->success ? NGX_OK : NGX_ERROR;
+    }
+
+    bytes = c->bytes;
+
+    rc = ngx_http_brotli_body_filter(r, in);
+    (*calls)++;
+
+    if (rc == NGX_ERROR) {
+      return NGX_ERROR;
+    }
+
+    if (in == NULL && c->bytes == bytes &&
+        !(ctx->closed && c->npending == 0)) {
+      ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                    "brotli bench: stall, %uz of %uz bytes in, "
+                    "%uz bytes out", ctx->bytes_in, data->len, c->bytes);
+      return NGX_ERROR;
+    }
+  }
+}
+
+#endif /* NGX_HTTP_BROTLI_BENCH_H_ */
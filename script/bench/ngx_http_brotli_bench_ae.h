@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) Google Inc.
+ */
+
+/*
+ * Accept-Encoding parsers under test: those of the filter and static modules,
+ * and ngx_http_brotli_ae_candidate(), if NGX_HTTP_BROTLI_BENCH_CANDIDATE is
+ * defined; all have the signature of check_accept_encoding().
+ */
+
+#ifndef NGX_HTTP_BROTLI_BENCH_AE_H_
+#define NGX_HTTP_BROTLI_BENCH_AE_H_
+
+#include "ngx_http_brotli_bench.h"
+
+typedef struct {
+  const char* name;
+  ngx_int_t (*check)(ngx_http_request_t* r);
+} ngx_http_brotli_bench_parser_t;
+
+ngx_int_t ngx_http_brotli_bench_static_accept_encoding(ngx_http_request_t* r);
+#if (NGX_HTTP_BROTLI_BENCH_CANDIDATE)
+ngx_int_t ngx_http_brotli_ae_candidate(ngx_http_request_t* r);
+#endif
+
+static ngx_http_brotli_bench_parser_t ngx_http_brotli_bench_parsers[] = {
+    {"filter", check_accept_encoding},
+    {"static", ngx_http_brotli_bench_static_accept_encoding},
+#if (NGX_HTTP_BROTLI_BENCH_CANDIDATE)
+    {"candidate", ngx_http_brotli_ae_candidate},
+#endif
+    {NULL, NULL}};
+
+/* Turns raw bytes into a header value nginx could have parsed: value ends
+   before NUL, CR or LF, and has no leading or trailing whitespace. Result is
+   in exactly sized allocation, so that overreads are caught by sanitizers. */
+static ngx_inline u_char* ngx_http_brotli_bench_ae_value(const u_char* data,
+                                                         size_t size,
+                                                         ngx_str_t* value) {
+  const u_char* end;
+  u_char* p;
+
+  end = data;
+  while (end < data + size && *end != '\0' && *end != CR && *end != LF) {
+    end++;
+  }
+  while (data < end && (*data == ' ' || *data == '\t')) {
+    data++;
+  }
+  while (end > data && (end[-1] == ' ' || end[-1] == '\t')) {
+    end--;
+  }
+
+  p = malloc(end - data + 1);
+  if (p == NULL) {
+    return NULL;
+  }
+
+  ngx_memcpy(p, data, end - data);
+  p[end - data] = '\0';
+
+  value->len = end - data;
+  value->data = p;
+
+  return p;
+}
+
+/* Runs all parsers on value; returns NGX_ERROR if they disagree, and the
+   verdict otherwise. */
+static ngx_inline ngx_int_t ngx_http_brotli_bench_ae_check(
+    ngx_http_request_t* r, ngx_str_t* value) {
+  ngx_http_brotli_bench_parser_t* p;
+  ngx_table_elt_t h;
+  ngx_int_t expected;
+  ngx_int_t rc;
+
+  ngx_memzero(&h, sizeof(ngx_table_elt_t));
+  h.value = *value;
+  r->headers_in.accept_encoding = &h;
+
+  expected = ngx_http_brotli_bench_parsers[0].check(r);
+
+  for (p = ngx_http_brotli_bench_parsers + 1; p->name; p++) {
+    rc = p->check(r);
+    if (rc != expected) {
+      fprintf(stderr, "\"%s\" says %d, \"%s\" says %d on \"%.*s\"\n",
+              ngx_http_brotli_bench_parsers[0].name, (int)expected, p->name,
+              (int)rc, (int)value->len, value->data);
+      expected = NGX_ERROR;
+    }
+  }
+
+  r->headers_in.accept_encoding = NULL;
+
+  return expected;
+}
+
+#endif /* NGX_HTTP_BROTLI_BENCH_AE_H_ */
@@ -0,0 +1,16 @@
+/*
+ * Copyright (C) Google Inc.
+ */
+
+/*
+ * Static module, compiled into benchmarks instead of its nginx object, so
+ * that its internals can be driven too.
+ */
+
+#include "../../static/ngx_http_brotli_static_module.c"
+
+ngx_int_t ngx_http_brotli_bench_static_accept_encoding(ngx_http_request_t* r);
+
+ngx_int_t ngx_http_brotli_bench_static_accept_encoding(ngx_http_request_t* r) {
+  return check_accept_encoding(r);
+}
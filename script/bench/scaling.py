@@ -0,0 +1,36 @@
+#!/usr/bin/env python3
+"""Adds scaling figures to JSON lines of script/bench/load.sh runs with
+different numbers of workers.
+
+  scaling.py < runs.jsonl > scaling.jsonl
+
+Runs are compared with the run of the same protocol, file, quality and
+clients with 1 worker: "speedup" is ratio of requests per second,
+"efficiency" is speedup per worker, and "cpu_growth" is ratio of worker CPU
+time per request, which rises when workers contend for shared state.
+"""
+
+import json
+import sys
+
+KEY = ("protocol", "file", "quality", "clients")
+
+
+def main():
+  runs = [json.loads(line) for line in sys.stdin if line.strip()]
+  base = {tuple(run[k] for k in KEY): run for run in runs
+          if run["workers"] == 1}
+
+  for run in runs:
+    one = base.get(tuple(run[k] for k in KEY))
+    if one and one["rps"]:
+      run["speedup"] = round(run["rps"] / one["rps"], 3)
+      run["efficiency"] = round(run["speedup"] / run["workers"], 3)
+      if one.get("cpu_us_per_request") and run.get("cpu_us_per_request"):
+        run["cpu_growth"] = round(
+            run["cpu_us_per_request"] / one["cpu_us_per_request"], 3)
+    print(json.dumps(run, sort_keys=True))
+
+
+if __name__ == "__main__":
+  main()
@@ -0,0 +1,39 @@
+#!/bin/bash
+set -e
+
+# Worker scaling: runs script/bench/load.sh with 1, 2, 4, ... MAX_WORKERS
+# workers and compression-heavy traffic, and reports speedup, efficiency per
+# worker and growth of CPU time per request against 1 worker. Results are
+# written to script/bench/out/scaling.jsonl, one JSON object per line.
+#
+#   MAX_WORKERS=8 DURATION=5 script/bench/scaling.sh
+#
+# Load generators run on the same machine; keep MAX_WORKERS below number of
+# CPUs, so that they are not starved.
+
+. script/bench/common.sh
+
+MAX_WORKERS=${MAX_WORKERS:-$((`nproc` / 2 > 0 ? `nproc` / 2 : 1))}
+export QUALITIES=${QUALITIES:-6}
+export FILES=${FILES:-"html-128k.html"}
+export CONCURRENCY=${CONCURRENCY:-256}
+export PROTOCOLS=${PROTOCOLS:-"http1"}
+export DURATION
+
+COUNTS=
+for ((workers = 1; workers < MAX_WORKERS; workers *= 2)); do
+  COUNTS="$COUNTS $workers"
+done
+COUNTS="$COUNTS $MAX_WORKERS"
+
+: > $OUT/scaling-runs.jsonl
+
+for workers in $COUNTS; do
+  echo "$workers workers"
+  WORKERS=$workers RESULTS=$OUT/scaling-$workers.jsonl script/bench/load.sh
+  cat $OUT/scaling-$workers.jsonl >> $OUT/scaling-runs.jsonl
+done
+
+python3 $BENCH/scaling.py < $OUT/scaling-runs.jsonl > $OUT/scaling.jsonl
+
+echo "Results: `wc -l < $OUT/scaling.jsonl` runs in $OUT/scaling.jsonl"
@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+"""Slow-client stress test of script/bench/slow.sh: holds connections that
+read at fixed rate, and writes JSON line every second with worker RSS,
+encoder memory, input queued in body filters and request pool bytes, in total
+and per stream, then summary line. Fails if RSS per connection, less what
+workers had before, ever exceeds ceiling.
+
+  slow.py <port> <path> <streams> <bytes/s> <seconds> <nginx pid file> \
+      <ceiling, KB> [key=value...]
+
+Keys given on command line are copied to output.
+"""
+
+import asyncio
+import json
+import socket
+import sys
+import time
+
+from streams import RCVBUF, rss_kb, status, workers
+
+BATCH = 256
+
+
+async def read_slowly(port, path, rate, deadline, counters):
+  sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+  sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, RCVBUF)
+  sock.setblocking(False)
+  loop = asyncio.get_running_loop()
+  try:
+    await loop.sock_connect(sock, ("127.0.0.1", port))
+    await loop.sock_sendall(sock, (
+        "GET /%s HTTP/1.1\r\nHost: localhost\r\nAccept-Encoding: br\r\n\r\n"
+        % path).encode())
+    counters["open"] += 1
+    start = time.monotonic()
+    received = 0
+    while time.monotonic() < deadline:
+      data = await loop.sock_recv(sock, 1024)
+      if not data:
+        counters["finished"] += 1
+        break
+      received += len(data)
+      counters["bytes"] += len(data)
+      # Paced against start, so that average rate is kept.
+      await asyncio.sleep(max(0, start + received / rate - time.monotonic()))
+  finally:
+    counters["open"] -= 1
+    sock.close()
+
+
+async def main(port, path, streams, rate, seconds, pid_file, ceiling, keys):
+  pids = workers(pid_file)
+  idle_rss = rss_kb(pids)
+  idle = status()
+
+  counters = {"open": 0, "finished": 0, "bytes": 0}
+  start = time.monotonic()
+  deadline = start + seconds
+  tasks = []
+  for first in range(0, streams, BATCH):
+    tasks += [asyncio.ensure_future(
+        read_slowly(port, path, rate, deadline, counters))
+        for _ in range(first, min(streams, first + BATCH))]
+    await asyncio.sleep(0.1)
+
+  peak = 0
+  peak_queued = 0
+  peak_pool = 0
+  samples = 0
+  while time.monotonic() < deadline:
+    await asyncio.sleep(1)
+    now = status()
+    rss = rss_kb(pids) - idle_rss
+    open_streams = counters["open"] or 1
+    per_stream = rss / open_streams if counters["open"] else 0
+    peak = max(peak, per_stream)
+    queued = now["queued_input"] - idle["queued_input"]
+    pool = now["pool"] - idle["pool"]
+    peak_queued = max(peak_queued, queued / open_streams)
+    peak_pool = max(peak_pool, pool / open_streams)
+    samples += 1
+    print(json.dumps(dict(keys, **{
+        "t": round(time.monotonic() - start, 1),
+        "open": counters["open"],
+        "finished": counters["finished"],
+        "bytes": counters["bytes"],
+        "rss_kb": rss,
+        "rss_per_stream_kb": round(per_stream, 1),
+        "encoders": now["encoders"] - idle["encoders"],
+        "encoder_bytes": now["memory"] - idle["memory"],
+        "queued_input_bytes": queued,
+        "queued_input_per_stream": round(queued / open_streams),
+        "pool_bytes": pool,
+        "pool_per_stream": round(pool / open_streams),
+    })))
+    sys.stdout.flush()
+
+  await asyncio.gather(*tasks, return_exceptions=True)
+
+  ok = peak <= ceiling
+  print(json.dumps(dict(keys, **{
+      "summary": True,
+      "streams": streams,
+      "rate": rate,
+      "seconds": seconds,
+      "samples": samples,
+      "peak_rss_per_stream_kb": round(peak, 1),
+      "peak_queued_input_per_stream": round(peak_queued),
+      "peak_pool_per_stream": round(peak_pool),
+      "ceiling_kb": ceiling,
+      "ok": ok,
+  })))
+  return ok
+
+
+if __name__ == "__main__":
+  if len(sys.argv) < 8:
+    sys.exit(__doc__)
+  keys = {}
+  for arg in sys.argv[8:]:
+    key, value = arg.split("=", 1)
+    keys[key] = int(value) if value.isdigit() else value
+  ok = asyncio.run(main(int(sys.argv[1]), sys.argv[2], int(sys.argv[3]),
+                        int(sys.argv[4]), int(sys.argv[5]), sys.argv[6],
+                        int(sys.argv[7]), keys))
+  sys.exit(0 if ok else 1)
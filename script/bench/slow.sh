@@ -0,0 +1,51 @@
+#!/bin/bash
+set -e
+
+# Slow-client stress test: STREAMS connections read large, compressible,
+# proxied responses at RATE bytes/s, while script/bench/backend.py writes as
+# fast as nginx takes them, with proxy buffering off and on. Worker RSS,
+# encoder memory, input queued in the filter and request pool bytes (per
+# stream, too) are sampled every second into script/bench/out/slow.jsonl;
+# the test fails if worker RSS per connection exceeds CEILING kilobytes, as it
+# would if input queued in filter grew without bound.
+#
+#   STREAMS=500 RATE=2048 DURATION=30 CEILING=4096 script/bench/slow.sh
+
+. script/bench/common.sh
+
+STREAMS=${STREAMS:-2000}
+RATE=${RATE:-4096}
+DURATION=${DURATION:-60}
+QUALITY=${QUALITY:-6}
+WINDOW=${WINDOW:-1m}
+# Bound for QUALITY and WINDOW defaults; encoder alone takes about 2 windows.
+CEILING=${CEILING:-4096}
+MODES=${MODES:-"unbuffered buffered"}
+RESULTS=${RESULTS:-$OUT/slow.jsonl}
+
+# Response of about 500 MB, more than any client reads in DURATION.
+RESPONSE="ndjson?events=1000000&interval=0&size=500"
+
+ulimit -n $((STREAMS * 2 + 1024))
+
+: > $RESULTS
+
+python3 $BENCH/backend.py 8090 &
+BACKEND=$!
+trap "kill $BACKEND" EXIT
+
+nginx_start $QUALITY $WINDOW
+
+failed=0
+for mode in $MODES; do
+  echo "$mode, $STREAMS streams at $RATE bytes/s for ${DURATION}s"
+  python3 $BENCH/slow.py 8084 "$mode/$RESPONSE" $STREAMS $RATE $DURATION \
+      $OUT/nginx.pid $CEILING mode=$mode quality=$QUALITY window=$WINDOW \
+      >> $RESULTS || failed=1
+  tail -n 1 $RESULTS
+  sleep 1
+done
+
+nginx_stop
+
+exit $failed
@@ -0,0 +1,14 @@
+-- wrk script of script/bench/static.sh: requests paths listed in URLS file
+-- in turn.
+
+local paths = {}
+for line in io.lines(os.getenv("URLS")) do
+  paths[#paths + 1] = line
+end
+
+local i = 0
+
+request = function()
+  i = i % #paths + 1
+  return wrk.format("GET", paths[i], {["Accept-Encoding"] = "br"})
+end
@@ -0,0 +1,91 @@
+#!/bin/bash
+set -e
+
+# Static handler benchmark: wrk requests corpus files from locations with
+# brotli_static off, on, always, and on with open_file_cache, for several
+# shares of requests whose files have .br versions. For every combination it
+# records requests/s and latency, then runs again under "strace -c" to count
+# system calls and opened file descriptors per request. Results are written to
+# script/bench/out/static.jsonl, one JSON object per line. Needs wrk, strace
+# (with permission to trace nginx workers) and "brotli" Python module.
+#
+#   MODES="on on-cached" HIT_RATIOS="100 0" DURATION=5 script/bench/static.sh
+
+. script/bench/common.sh
+
+MODES=${MODES:-"off on always on-cached"}
+# Percent of requests for files that have .br versions.
+HIT_RATIOS=${HIT_RATIOS:-"100 50 0"}
+CONCURRENCY=${CONCURRENCY:-16}
+DURATION=${DURATION:-10}
+TRACE_DURATION=${TRACE_DURATION:-3}
+RESULTS=${RESULTS:-$OUT/static.jsonl}
+
+THREADS=`nproc`
+THREADS=$((CONCURRENCY < THREADS ? CONCURRENCY : THREADS))
+
+python3 $BENCH/corpus.py $OUT/corpus
+
+# Every corpus file is served as "hit-<name>", with .br version, and as
+# "miss-<name>", without.
+rm -rf $OUT/static
+mkdir -p $OUT/static
+python3 - $OUT/corpus $OUT/static <<'PYTHON'
+import brotli, os, shutil, sys
+for name in sorted(os.listdir(sys.argv[1])):
+  source = os.path.join(sys.argv[1], name)
+  hit = os.path.join(sys.argv[2], "hit-" + name)
+  shutil.copy(source, hit)
+  shutil.copy(source, os.path.join(sys.argv[2], "miss-" + name))
+  with open(hit + ".br", "wb") as f:
+    f.write(brotli.compress(open(source, "rb").read()))
+PYTHON
+
+FILES=`ls $OUT/corpus`
+
+# Writes URLS file: 100 paths under location, ratio of them hits.
+urls() {
+  local i=0
+  : > $OUT/static-urls.txt
+  while [ $i -lt 100 ]; do
+    for file in $FILES; do
+      [ $i -lt 100 ] || break
+      if [ $i -lt $2 ]; then kind=hit; else kind=miss; fi
+      echo "/$1/$kind-$file" >> $OUT/static-urls.txt
+      i=$((i + 1))
+    done
+  done
+}
+
+load() {
+  URLS=$OUT/static-urls.txt wrk -t $THREADS -c $CONCURRENCY -d ${1}s --latency \
+      -s $BENCH/static.lua http://127.0.0.1:8085 > $2
+}
+
+: > $RESULTS
+nginx_start 6
+
+for mode in $MODES; do
+  for ratio in $HIT_RATIOS; do
+    echo "brotli_static $mode, $ratio% hits"
+    urls $mode $ratio
+
+    load $DURATION $OUT/report.txt
+    python3 $BENCH/loadstat.py http1 $OUT/report.txt - > $OUT/static-load.json
+
+    strace -c -f -o $OUT/strace.txt `workers | sed 's/^/-p /'` &
+    STRACE=$!
+    sleep 1
+    load $TRACE_DURATION $OUT/trace.txt
+    kill -INT $STRACE
+    wait $STRACE || true
+
+    python3 $BENCH/syscalls.py $OUT/strace.txt $OUT/trace.txt \
+        @$OUT/static-load.json mode=$mode hit_ratio=$ratio \
+        clients=$CONCURRENCY >> $RESULTS
+  done
+done
+
+nginx_stop
+
+echo "Results: `wc -l < $RESULTS` runs in $RESULTS"
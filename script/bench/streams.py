@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+"""Holds many slow-reading connections open against nginx of
+script/bench/streams.sh and writes JSON line with worker memory at steady
+state.
+
+  streams.py <port> <path> <streams> <nginx pid file> [key=value...]
+
+Every connection has small receive buffer and reads nothing but the first
+bytes of response, so that its encoder stays alive. Once the number of live
+encoders settles, worker RSS and encoder memory from brotli_status are
+recorded, minus what they were before connections were opened. Keys given on
+command line are copied to output.
+"""
+
+import asyncio
+import json
+import socket
+import subprocess
+import sys
+import time
+import urllib.request
+
+STATUS = "http://127.0.0.1:8081/brotli_status"
+RCVBUF = 4096
+BATCH = 256
+SETTLE_SECONDS = 2
+TIMEOUT_SECONDS = 120
+
+
+def workers(pid_file):
+  pid = open(pid_file).read().strip()
+  return subprocess.check_output(["pgrep", "-P", pid]).decode().split()
+
+
+def rss_kb(pids):
+  kb = 0
+  for pid in pids:
+    for line in open("/proc/%s/status" % pid):
+      if line.startswith("VmRSS:"):
+        kb += int(line.split()[1])
+  return kb
+
+
+def status():
+  with urllib.request.urlopen(STATUS) as f:
+    workers = json.load(f)["workers"]
+  return {key: sum(w[key] for w in workers)
+          for key in ("memory", "encoders", "queued_input", "pool")}
+
+
+async def open_stream(port, path):
+  sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+  sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, RCVBUF)
+  sock.setblocking(False)
+  loop = asyncio.get_running_loop()
+  await loop.sock_connect(sock, ("127.0.0.1", port))
+  await loop.sock_sendall(sock, (
+      "GET /%s HTTP/1.1\r\nHost: localhost\r\nAccept-Encoding: br\r\n\r\n"
+      % path).encode())
+  # Status line is enough to know response is under way.
+  if not await loop.sock_recv(sock, 1):
+    sock.close()
+    return None
+  return sock
+
+
+async def main(port, path, streams, pid_file, keys):
+  pids = workers(pid_file)
+  idle_rss = rss_kb(pids)
+  idle = status()
+
+  socks = []
+  for start in range(0, streams, BATCH):
+    batch = [open_stream(port, path)
+             for _ in range(start, min(streams, start + BATCH))]
+    for result in await asyncio.gather(*batch, return_exceptions=True):
+      if isinstance(result, socket.socket):
+        socks.append(result)
+
+  # Steady state: number of live encoders no longer changes.
+  deadline = time.time() + TIMEOUT_SECONDS
+  last = status()
+  while time.time() < deadline:
+    await asyncio.sleep(SETTLE_SECONDS)
+    now = status()
+    if now["encoders"] == last["encoders"]:
+      break
+    last = now
+
+  rss = rss_kb(pids) - idle_rss
+  memory = last["memory"] - idle["memory"]
+  encoders = last["encoders"] - idle["encoders"]
+
+  for sock in socks:
+    sock.close()
+
+  result = dict(keys)
+  result.update({
+      "streams": streams,
+      "open": len(socks),
+      "encoders": encoders,
+      "rss_kb": rss,
+      "encoder_bytes": memory,
+      "rss_per_stream": round(rss * 1024.0 / len(socks)) if socks else None,
+      "encoder_bytes_per_stream": (round(float(memory) / encoders)
+                                   if encoders else None),
+  })
+  print(json.dumps(result))
+
+
+if __name__ == "__main__":
+  keys = {}
+  for arg in sys.argv[5:]:
+    key, value = arg.split("=", 1)
+    keys[key] = int(value) if value.isdigit() else value
+  asyncio.run(main(int(sys.argv[1]), sys.argv[2], int(sys.argv[3]),
+                   sys.argv[4], keys))
@@ -0,0 +1,43 @@
+#!/bin/bash
+set -e
+
+# Memory per concurrent stream: holds STREAMS slow-reading connections open
+# against nginx for every quality, window and file, and records worker RSS and
+# encoder memory at steady state. Results are written to
+# script/bench/out/streams.jsonl, one JSON object per line.
+#
+#   STREAMS=1000 QUALITIES=6 WINDOWS="64k 4m" script/bench/streams.sh
+
+. script/bench/common.sh
+
+STREAMS=${STREAMS:-10000}
+QUALITIES=${QUALITIES:-"1 4 6 9 11"}
+WINDOWS=${WINDOWS:-"64k 256k 1m 4m 16m"}
+FILES=${FILES:-"html-128k.html html-1m.html"}
+WORKERS=${WORKERS:-1}
+RESULTS=${RESULTS:-$OUT/streams.jsonl}
+
+# Every stream is a socket in client and nginx, and a file in nginx.
+ulimit -n $((STREAMS * 2 + 1024))
+
+python3 $BENCH/corpus.py $OUT/corpus
+: > $RESULTS
+
+for quality in $QUALITIES; do
+  for window in $WINDOWS; do
+    nginx_start $quality $window
+
+    for file in $FILES; do
+      echo "quality $quality, window $window, $file, $STREAMS streams"
+      python3 $BENCH/streams.py 8083 $file $STREAMS $OUT/nginx.pid \
+          quality=$quality window=$window file=$file workers=$WORKERS \
+          >> $RESULTS
+      # Closed connections are gone before next file.
+      sleep 1
+    done
+
+    nginx_stop
+  done
+done
+
+echo "Results: `wc -l < $RESULTS` runs in $RESULTS"
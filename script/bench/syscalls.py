@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+"""Turns "strace -c" summary of nginx workers and report of wrk run that was
+traced into JSON line of script/bench/static.sh: system calls per request,
+in total and by name, and file descriptors opened per request.
+
+  syscalls.py <strace summary> <wrk report> [key=value | @file.json...]
+
+Keys given on command line, and those of JSON objects in files, are copied
+to output.
+"""
+
+import json
+import re
+import sys
+
+# File descriptors are created by these.
+OPENS = ("open", "openat", "openat2", "accept", "accept4")
+
+
+def main():
+  if len(sys.argv) < 3:
+    sys.exit(__doc__)
+
+  result = {}
+  for arg in sys.argv[3:]:
+    if arg.startswith("@"):
+      result.update(json.load(open(arg[1:])))
+      continue
+    key, value = arg.split("=", 1)
+    result[key] = int(value) if value.isdigit() else value
+
+  requests = int(re.search(r"(\d+) requests in",
+                           open(sys.argv[2]).read()).group(1))
+
+  calls = {}
+  errors = {}
+  for line in open(sys.argv[1]):
+    fields = line.split()
+    # % time, seconds, usecs/call, calls, [errors,] syscall
+    if len(fields) not in (5, 6) or not fields[3].isdigit():
+      continue
+    name = fields[-1]
+    if name == "total":
+      continue
+    calls[name] = int(fields[3])
+    if len(fields) == 6:
+      errors[name] = int(fields[4])
+
+  result.update({
+      "traced_requests": requests,
+      "syscalls_per_request": round(sum(calls.values()) / requests, 2),
+      "failed_per_request": round(sum(errors.values()) / requests, 2),
+      "opens_per_request": round(
+          sum(calls.get(name, 0) for name in OPENS) / requests, 2),
+      "syscalls": {name: round(n / requests, 2)
+                   for name, n in sorted(calls.items())},
+  })
+  print(json.dumps(result))
+
+
+if __name__ == "__main__":
+  main()
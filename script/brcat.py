@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+"""Decompresses files made of concatenated Brotli streams, such as
+"brotli_event_log ... brotli", to standard output. Standard decoders stop
+at the end of the first stream.
+
+  brcat.py [file...]
+
+Reads standard input, if no file is given. Uses libbrotlidec; set BROTLIDEC
+to its path, if it is not found.
+
+A stream that is cut short, e.g. by an incomplete write, or corrupt, is
+reported with its offset and skipped: the rest of the file is scanned for the
+next stream that decodes completely, and output continues from there. Exit
+status is 1, if anything was skipped.
+"""
+
+import ctypes
+import ctypes.util
+import os
+import sys
+
+CHUNK = 1 << 16
+
+ERROR, SUCCESS, NEEDS_MORE_INPUT, NEEDS_MORE_OUTPUT = range(4)
+
+
+def load():
+  path = os.environ.get("BROTLIDEC") or ctypes.util.find_library("brotlidec")
+  if not path:
+    sys.exit("brcat.py: libbrotlidec not found, set BROTLIDEC")
+  lib = ctypes.CDLL(path)
+  lib.BrotliDecoderCreateInstance.restype = ctypes.c_void_p
+  lib.BrotliDecoderCreateInstance.argtypes = [
+      ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p]
+  lib.BrotliDecoderDestroyInstance.argtypes = [ctypes.c_void_p]
+  lib.BrotliDecoderDecompressStream.argtypes = [
+      ctypes.c_void_p,
+      ctypes.POINTER(ctypes.c_size_t), ctypes.POINTER(ctypes.c_void_p),
+      ctypes.POINTER(ctypes.c_size_t), ctypes.POINTER(ctypes.c_void_p),
+      ctypes.c_void_p]
+  return lib
+
+
+def decode(lib, src, size, offset):
+  """Decodes one stream of src starting at offset; returns its output and
+  end offset, or None, if it is corrupt or cut short."""
+  dst = ctypes.create_string_buffer(CHUNK)
+  available_in = ctypes.c_size_t(size - offset)
+  next_in = ctypes.c_void_p(ctypes.addressof(src) + offset)
+  output = []
+  state = lib.BrotliDecoderCreateInstance(None, None, None)
+  try:
+    while True:
+      available_out = ctypes.c_size_t(CHUNK)
+      next_out = ctypes.c_void_p(ctypes.addressof(dst))
+      result = lib.BrotliDecoderDecompressStream(
+          state, ctypes.byref(available_in), ctypes.byref(next_in),
+          ctypes.byref(available_out), ctypes.byref(next_out), None)
+      output.append(dst.raw[:CHUNK - available_out.value])
+      if result == SUCCESS:
+        return b"".join(output), size - available_in.value
+      if result != NEEDS_MORE_OUTPUT:
+        return None
+  finally:
+    lib.BrotliDecoderDestroyInstance(state)
+
+
+def decompress(lib, data, out, name):
+  """Writes every complete stream of data to out; returns number of damaged
+  ranges skipped."""
+  src = ctypes.create_string_buffer(data, len(data))
+  offset = 0
+  damaged = 0
+  while offset < len(data):
+    stream = decode(lib, src, len(data), offset)
+    if stream:
+      out.write(stream[0])
+      offset = stream[1]
+      continue
+
+    # Streams have no marker to look for; single bytes are valid empty
+    # streams, so the next one must also have output.
+    damaged += 1
+    start = offset
+    offset += 1
+    while offset < len(data):
+      stream = decode(lib, src, len(data), offset)
+      if stream and stream[0]:
+        break
+      offset += 1
+    out.flush()
+    sys.stderr.write(
+        "brcat.py: %s: corrupt or truncated stream at offset %d, "
+        "%d bytes skipped\n" % (name, start, offset - start))
+  return damaged
+
+
+def main():
+  lib = load()
+  out = sys.stdout.buffer
+  damaged = 0
+  for name in sys.argv[1:] or ["-"]:
+    if name == "-":
+      data = sys.stdin.buffer.read()
+    else:
+      with open(name, "rb") as f:
+        data = f.read()
+    damaged += decompress(lib, data, out, name)
+  out.flush()
+  if damaged:
+    sys.exit(1)
+
+
+if __name__ == "__main__":
+  main()
@@ -18,6 +18,14 @@ typedef struct {
   ngx_uint_t enable;
 } configuration_t;
 
+/* Outcome of pre-compressed file lookup, reported by "$brotli_static". */
+#define NGX_HTTP_BROTLI_STATIC_MISS 1
+#define NGX_HTTP_BROTLI_STATIC_HIT 2
+
+typedef struct {
+  ngx_uint_t result;
+} context_t;
+
 static ngx_conf_enum_t kBrotliStaticEnum[] = {
     {ngx_string("off"), NGX_HTTP_BROTLI_STATIC_OFF},
     {ngx_string("on"), NGX_HTTP_BROTLI_STATIC_ON},
@@ -32,6 +40,9 @@ static ngx_int_t handler(ngx_http_request_t* req);
 static void* create_conf(ngx_conf_t* root_cfg);
 static char* merge_conf(ngx_conf_t* root_cfg, void* parent, void* child);
 static ngx_int_t init(ngx_conf_t* root_cfg);
+static ngx_int_t add_variables(ngx_conf_t* root_cfg);
+static ngx_int_t variable(ngx_http_request_t* req, ngx_http_variable_value_t* v,
+                          uintptr_t data);
 
 /* << Forward declarations*/
 
@@ -46,8 +57,8 @@ static ngx_command_t kCommands[] = {
     ngx_null_command};
 
 static ngx_http_module_t kModuleContext = {
-    NULL, /* preconfiguration */
-    init, /* postconfiguration */
+    add_variables, /* preconfiguration */
+    init,          /* postconfiguration */
 
     NULL, /* create main configuration */
     NULL, /* init main configuration */
@@ -80,6 +91,7 @@ static const char kEncoding[] = "br";
 static const size_t kEncodingLen = 2; /* strlen(kEncoding) */
 static const u_char kSuffix[] = ".br";
 static const size_t kSuffixLen = 3; /* strlen(kSuffix) */
+static ngx_str_t kVariableName = ngx_string("brotli_static");
 
 static ngx_int_t check_accept_encoding(ngx_http_request_t* req) {
   ngx_table_elt_t* accept_encoding_entry;
@@ -151,6 +163,18 @@ static ngx_int_t check_accept_encoding(ngx_http_request_t* req) {
   return NGX_OK;
 }
 
+/* Remember lookup outcome for "$brotli_static". */
+static void set_result(ngx_http_request_t* req, ngx_uint_t result) {
+  context_t* ctx;
+  ctx = ngx_http_get_module_ctx(req, ngx_http_brotli_static_module);
+  if (ctx == NULL) {
+    ctx = ngx_pcalloc(req->pool, sizeof(context_t));
+    if (ctx == NULL) return;
+    ngx_http_set_ctx(req, ctx, ngx_http_brotli_static_module);
+  }
+  ctx->result = result;
+}
+
 /* Test if this request is allowed to have the brotli response. */
 static ngx_int_t check_eligility(ngx_http_request_t* req) {
   if (req != req->main) return NGX_DECLINED;
@@ -251,6 +275,7 @@ static ngx_int_t handler(ngx_http_request_t* req) {
                             req->pool);
   if (rc != NGX_OK) {
     ngx_uint_t level;
+    set_result(req, NGX_HTTP_BROTLI_STATIC_MISS);
     switch (file_info.err) {
       case 0: /* Should not happen if rc != NGX_OK */
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
@@ -287,6 +312,7 @@ static ngx_int_t handler(ngx_http_request_t* req) {
   /* Only files are supported. */
   if (file_info.is_dir) {
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, log, 0, "http brotli_static file is a directory");
+    set_result(req, NGX_HTTP_BROTLI_STATIC_MISS);
     if (file_info.fd != NGX_INVALID_FILE) {
         ngx_close_file(file_info.fd); /* Close the opened directory handle */
     }
@@ -296,6 +322,7 @@ static ngx_int_t handler(ngx_http_request_t* req) {
   if (!file_info.is_file) {
     ngx_log_error(NGX_LOG_CRIT, log, 0, "\"%V\" is not a regular file",
                   &path);
+    set_result(req, NGX_HTTP_BROTLI_STATIC_MISS);
     if (file_info.fd != NGX_INVALID_FILE) {
         ngx_close_file(file_info.fd);
     }
@@ -303,6 +330,8 @@ static ngx_int_t handler(ngx_http_request_t* req) {
   }
 #endif
 
+  set_result(req, NGX_HTTP_BROTLI_STATIC_HIT);
+
   /* Prepare request push the body. */
   req->root_tested = !req->error_page;
   rc = ngx_http_discard_request_body(req);
@@ -410,3 +439,35 @@ static ngx_int_t init(ngx_conf_t* root_cfg) {
   *handler_slot = handler;
   return NGX_OK;
 }
+
+static ngx_int_t add_variables(ngx_conf_t* root_cfg) {
+  ngx_http_variable_t* var;
+  var = ngx_http_add_variable(root_cfg, &kVariableName,
+                              NGX_HTTP_VAR_NOCACHEABLE);
+  if (var == NULL) return NGX_ERROR;
+  var->get_handler = variable;
+  return NGX_OK;
+}
+
+/* "hit" if pre-compressed file was served, "miss" if it was looked up in vain;
+   not found if lookup was not attempted. */
+static ngx_int_t variable(ngx_http_request_t* req, ngx_http_variable_value_t* v,
+                          uintptr_t data) {
+  context_t* ctx;
+  ctx = ngx_http_get_module_ctx(req, ngx_http_brotli_static_module);
+  if (ctx == NULL || ctx->result == 0) {
+    v->not_found = 1;
+    return NGX_OK;
+  }
+  v->valid = 1;
+  v->no_cacheable = 0;
+  v->not_found = 0;
+  if (ctx->result == NGX_HTTP_BROTLI_STATIC_HIT) {
+    v->len = sizeof("hit") - 1;
+    v->data = (u_char*)"hit";
+  } else {
+    v->len = sizeof("miss") - 1;
+    v->data = (u_char*)"miss";
+  }
+  return NGX_OK;
+}